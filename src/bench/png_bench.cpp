@@ -0,0 +1,1565 @@
+/* --- --- --- --- PNG Decoder Benchmark (host only) --- --- --- --- */
+
+// Times each stage of the PNGdec pipeline (inflate, DeFilter, color conversion)
+// separately, plus a whole `PNG::decode()`, over the hardcoded images and the
+// generated corpus (tools/make_png_corpus.py). `defilter` is the kernel set the
+// decoder picks per image, `defilter0` the scalar reference it's checked against.
+// The rgb565/rgb888 stages use the packed line converters only when built with
+// PNG_PACKED_CONVERT=1 (the default on ARMv7E-M), so time both ways on a host.
+// `888,mask` is RGB888 then a separate alpha mask pass, `888+mask` the fused one.
+// The read-ahead line decodes from a throttled in-memory stand-in for the SD card,
+// with and without `ReadAhead` (src/include/readahead.hpp) in front of it.
+// The frame table line plays an animation from a stub directory of frame files on a
+// stub card through src/include/frametable.hpp, counting filesystem calls per frame.
+// The decoder RAM report sizes `PNG<>` against the panel-sized `PNG<64, 4, ...>`
+// and checks that they decode every image the same (or fail it outright). The too-wide
+// line checks that images wider than a decoder's iMaxWidth fail to open, even at bit
+// depths whose lines would fit its line buffer, and that `cacheLine()` drops lines
+// wider than a `FrameCache` row instead of writing past it.
+// `frame` is a whole decode into a `setBuffer()` frame with the window-less `PNG<64, 4, 0>`.
+// `cached` is `decode` again with the Huffman table cache on, so only the first one builds tables.
+// `inflate` uses inffast_wide.c's inflate_fast() (PNG_FAST_INFLATE=1, as platformio.ini
+// builds it); build with PNG_FAST_INFLATE=0 to time zlib's own inffast.c. Either is
+// checked against what Python's zlib inflated the corpus to.
+// The QOI lines time src/include/qoi.hpp on the corpus's QOI copies of the rgb8 and
+// rgba8 scenes against the PNGs of the same pixels, after checking they decode the same.
+// The HSV line checks src/include/hsv.hpp's row conversions against the per-pixel ones
+// for every 24-bit input, and times both. The bloom table is checked against the old
+// per-pixel float bloom at every scale the IR remote can set. The span line checks
+// src/include/span.hpp's clipped blends and jitter shifts on a stub back buffer.
+// The color cache lines time bloom through src/include/colorcache.hpp against
+// computing it for every pixel, on every 24-bit color (all misses) and on the
+// hardcoded images drawn for 64 frames.
+// The frame cache lines time a frame of each hardcoded still decoded, converted and
+// blitted every frame (as before src/include/framecache.hpp) against blitted from
+// its cache.
+//
+// Build & run: `pio run -e native -t exec`, or `.pio/build/native/program [iterations]`.
+// MB/s is always in terms of decoded pixel bytes (`iPitch * iHeight`) so the
+// stages can be compared with each other. The CRCs printed per image cover the
+// defiltered pixels and the RGB565 and RGB888 output, so an optimisation that changes
+// decoded output shows up as a changed CRC against the baseline run.
+
+#include <chrono>
+#include <math.h>
+
+#include "../include/PNGdec/PNGdec.h"
+
+// The stage functions are `static` inside png.inl, so pull in a private copy. The
+// bench drives the stages itself, so the copy's whole-decode entry points go unused.
+PNG_STATIC int PNGInit(PNGIMAGE *pPNG) __attribute__((unused));
+PNG_STATIC int DecodePNG(PNGIMAGE *pImage, void *pUser, int iOptions) __attribute__((unused));
+PNG_STATIC int32_t readFLASH(PNGFILE *pFile, uint8_t *pBuf, int32_t iLen) __attribute__((unused));
+PNG_STATIC uint8_t PNGMakeMask(PNGDRAW *pDraw, uint8_t *pMask, uint8_t ucThreshold);
+#include "../include/PNGdec/png.inl"
+#include "../include/readahead.hpp"
+#include <fcntl.h> // `O_RDONLY`, which SdFat defines on the Teensy.
+#include "../include/frametable.hpp"
+#include "../include/qoi.hpp"
+#include "../include/hsv.hpp"
+#include "../include/bloom.hpp"
+#include "../include/colorcache.hpp"
+#include "../include/glitchrand.hpp"
+#include "../include/blend.hpp"
+#include "../include/span.hpp"
+#include "../include/framecache.hpp"
+
+#include "../hardcoded_images/knockedtfout.h"
+#include "../hardcoded_images/test_card.h"
+#include "png_corpus.h"
+
+namespace BENCH {
+    typedef std::chrono::steady_clock Clock;
+
+    PNG<> png;
+    PNGIMAGE info; // Header info of the image being benchmarked, parsed by the real decoder.
+
+    uint8_t  idat[1 << 17]; // All IDAT payloads of the current image, concatenated.
+    uint8_t  filtered[64 * (64*4 + 1)]; // Inflated rows, filter byte included.
+    uint8_t  defiltered[64 * (64*4 + 1)];
+    uint8_t  zeroRow[64*4 + 1];
+    uint16_t rgb565[64];
+    uint8_t  rgb888[64*3], rgb888Fused[64*3];
+    uint8_t  mask[8], maskFused[8];
+    uint8_t  zlibState[32768 + sizeof(inflate_state)];
+
+    int iterations = 200;
+
+    inline double nsSince(Clock::time_point start) {
+        return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+    void noopDraw(PNGDRAW *pDraw) { (void)pDraw; }
+
+    void checkFusedMaskLine(PNGDRAW *pDraw) {
+        uint8_t ref[64*3], fused[64*3], refMask[8], fusedMask[8];
+        uint8_t ucSummary = PNGRGB888Mask(pDraw, fused, fusedMask, 128, 0);
+        uint8_t ucAll = 0xff;
+
+        if (pDraw->iPixelType == PNG_PIXEL_INDEXED && pDraw->iBpp == 1) {
+            return; // `PNGMakeMask()` has no 1-bit indexed case
+        }
+        PNGRGB888(pDraw, ref, 0, pDraw->iHasAlpha);
+        uint8_t ucAny = PNGMakeMask(pDraw, refMask, 128);
+        for (int i = 0; i < 8; i++) ucAll &= refMask[i];
+
+        *(int *)pDraw->pUser += memcmp(ref, fused, sizeof(ref)) != 0 || memcmp(refMask, fusedMask, sizeof(refMask)) != 0
+            || !!ucAny != !!(ucSummary & PNG_MASK_ANY_OPAQUE) || (ucAll == 0xff) != !!(ucSummary & PNG_MASK_ALL_OPAQUE);
+    }
+
+    void checkPaletteLookupLine(PNGDRAW *pDraw) {
+        uint8_t ref[64*3], palette[256*3], paletteMask[32], indexes[64], looked[64*3], refMask[8];
+
+        PNGRGB888Mask(pDraw, ref, refMask, 1, 0);
+        if (!PNGPalette888Mask(pDraw, palette, paletteMask, 1, 0) || PNGIndexes(pDraw, indexes) == 0) {
+            return; // not indexed
+        }
+        for (int x = 0; x < pDraw->iWidth; x++) {
+            memcpy(&looked[x * 3], &palette[indexes[x] * 3], 3);
+        }
+        *(int *)pDraw->pUser += memcmp(ref, looked, pDraw->iWidth * 3) != 0;
+    }
+
+    void checkAlphaLine(PNGDRAW *pDraw) {
+        uint8_t rgb[64*3], alpha[64], mask[8], solidMask[8];
+
+        PNGRGB888Mask(pDraw, rgb, mask, 1, 0);
+        uint8_t ucSolid = PNGRGB888Mask(pDraw, rgb, solidMask, 255, 0) & PNG_MASK_ALL_OPAQUE;
+        int iOpaque = PNGAlpha(pDraw, alpha);
+        for (int x = 0; x < pDraw->iWidth; x++) {
+            int bit = 0x80 >> (x & 7);
+            *(int *)pDraw->pUser += !!(mask[x >> 3] & bit) != (alpha[x] >= 1) || !!(solidMask[x >> 3] & bit) != (alpha[x] == 255);
+        }
+        *(int *)pDraw->pUser += !!ucSolid != !!iOpaque;
+    }
+
+    struct LineCRC { uLong crc; int lines; };
+
+    void crcLine(PNGDRAW *pDraw) {
+        LineCRC *pCRC = (LineCRC *)pDraw->pUser;
+
+        pCRC->crc = crc32(pCRC->crc, (const Bytef *)&pDraw->y, sizeof(pDraw->y));
+        pCRC->crc = crc32(pCRC->crc, pDraw->pPixels, pDraw->iPitch);
+        pCRC->lines++;
+    }
+
+    /* Concatenates the IDAT chunk payloads. Returns their total length. */
+    int gatherIDAT(const uint8_t *pData, int iDataLen) {
+        int iLen = 0;
+
+        for (int i = 8; i + 8 <= iDataLen; ) {
+            int iChunkLen = MOTOLONG(&pData[i]);
+            if (MOTOLONG(&pData[i+4]) == 0x49444154) { // 'IDAT'
+                memcpy(&idat[iLen], &pData[i+8], iChunkLen);
+                iLen += iChunkLen;
+            }
+            i += iChunkLen + 12; // length + marker + data + CRC
+        }
+
+        return iLen;
+    }
+
+    /* Inflates one row at a time, the same way `DecodePNG()` hands zlib its output buffer. */
+    bool inflateRows(int iIDATLen) {
+        z_stream d_stream;
+        struct inflate_state *state = (struct inflate_state *)zlibState;
+        int iRowLen = info.iPitch + 1;
+        int err = Z_OK;
+
+        memset(&d_stream, 0, sizeof(d_stream));
+        d_stream.state = (struct internal_state *)state;
+        state->window = &zlibState[sizeof(inflate_state)];
+        inflateInit(&d_stream);
+
+        d_stream.next_in = idat;
+        d_stream.avail_in = iIDATLen;
+        for (int y = 0; y < info.iHeight && (err == Z_OK || err == Z_STREAM_END); y++) {
+            d_stream.next_out = &filtered[y * iRowLen];
+            d_stream.avail_out = iRowLen;
+            while (d_stream.avail_out && (err = inflate(&d_stream, Z_NO_FLUSH, 0)) == Z_OK) { }
+        }
+
+        inflateEnd(&d_stream);
+        return d_stream.avail_out == 0;
+    }
+
+    /* `pfnKernels` is either what the decoder picks for this image, or the scalar reference. */
+    void defilterRows(PNG_DEFILTER_FUNC * const *pfnKernels) {
+        int iRowLen = info.iPitch + 1;
+        int iBpp = PNGFilterBpp(info.iWidth, info.iPitch);
+        uint8_t *pPrev = zeroRow;
+
+        for (int y = 0; y < info.iHeight; y++) {
+            DeFilterLine(pfnKernels, &defiltered[y * iRowLen], pPrev, info.iPitch, iBpp);
+            pPrev = &defiltered[y * iRowLen];
+        }
+    }
+
+    /* Checks every de-filter kernel against the scalar reference on random rows. Returns the mismatch count. */
+    int verifyDeFilterKernels() {
+        uint8_t prev[1 + 64*4], fast[1 + 64*4], ref[1 + 64*4];
+        int iMismatches = 0;
+
+        srand(1);
+        for (int iBpp = 1; iBpp <= 4; iBpp++) {
+            int iWidth = 64, iPitch = 64 * iBpp;
+            for (int iFilter = 0; iFilter < PNG_FILTER_COUNT; iFilter++) {
+                for (int i = 0; i < 100; i++) {
+                    for (int x = 0; x <= iPitch; x++) {
+                        prev[x] = rand();
+                        ref[x] = fast[x] = rand();
+                    }
+                    ref[0] = fast[0] = iFilter;
+                    DeFilterLine(pfnDeFilterScalar, ref, prev, iPitch, iBpp);
+                    DeFilterLine(PNGDeFilterKernels(iWidth, iPitch), fast, prev, iPitch, iBpp);
+                    iMismatches += memcmp(ref, fast, iPitch + 1) != 0;
+                }
+            }
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks the packed RGB565/RGB888 line converters against the per-byte loops on random lines. Returns the mismatch count. */
+    int verifyPackedConverters() {
+        uint8_t  line[64*4], palette[1024];
+        uint16_t fastPalette[256], ref565[64], packed565[64];
+        uint8_t  ref888[64*3], packed888[64*3];
+        PNGDRAW  pngd;
+        int iMismatches = 0;
+
+        srand(2);
+        memset(&pngd, 0, sizeof(pngd));
+        pngd.iBpp = 8;
+        pngd.pPixels = line;
+        pngd.pPalette = palette;
+        for (int i = 0; i < 100; i++) {
+            for (size_t j = 0; j < sizeof(line); j++) line[j] = rand();
+            for (size_t j = 0; j < sizeof(palette); j++) palette[j] = rand();
+            for (int j = 0; j < 256; j++) fastPalette[j] = PNGPack565(palette[j*3] | (palette[j*3+1] << 8) | (palette[j*3+2] << 16));
+
+            pngd.iWidth = (i & 1) ? 64 : 61; // odd widths exercise the tails
+            for (int iEndian = PNG_RGB565_LITTLE_ENDIAN; iEndian <= PNG_RGB565_BIG_ENDIAN; iEndian++) {
+                pngd.iPixelType = PNG_PIXEL_TRUECOLOR_ALPHA;
+                PNGRGB565(&pngd, ref565, iEndian, 0xffffffff, 0);
+                PNGPackedRGBATo565(line, packed565, pngd.iWidth, iEndian);
+                iMismatches += memcmp(ref565, packed565, pngd.iWidth * 2) != 0;
+
+                pngd.iPixelType = PNG_PIXEL_TRUECOLOR;
+                PNGRGB565(&pngd, ref565, iEndian, 0xffffffff, 0);
+                PNGPackedRGBTo565(line, packed565, pngd.iWidth, iEndian);
+                iMismatches += memcmp(ref565, packed565, pngd.iWidth * 2) != 0;
+
+                pngd.iPixelType = PNG_PIXEL_INDEXED;
+                for (int iFast = 0; iFast < 2; iFast++) {
+                    pngd.pFastPalette = iFast ? fastPalette : NULL;
+                    PNGRGB565(&pngd, ref565, iEndian, 0xffffffff, 0);
+                    PNGPackedIndexedTo565(line, packed565, pngd.iWidth, palette, pngd.pFastPalette, iEndian);
+                    iMismatches += memcmp(ref565, packed565, pngd.iWidth * 2) != 0;
+                }
+                pngd.pFastPalette = NULL;
+            }
+
+            pngd.iPixelType = PNG_PIXEL_TRUECOLOR_ALPHA;
+            PNGRGB888(&pngd, ref888, 0xffffffff, 0);
+            PNGPackedRGBATo888(line, packed888, pngd.iWidth);
+            iMismatches += memcmp(ref888, packed888, pngd.iWidth * 3) != 0;
+
+            pngd.iPixelType = PNG_PIXEL_INDEXED;
+            PNGRGB888(&pngd, ref888, 0xffffffff, 0);
+            PNGPackedIndexedTo888(line, packed888, pngd.iWidth, palette);
+            iMismatches += memcmp(ref888, packed888, pngd.iWidth * 3) != 0;
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks `PNGRGB888Mask()` against `PNGRGB888()` + `PNGMakeMask()` on every corpus line. Returns the mismatch count. */
+    int verifyFusedMask() {
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, checkFusedMaskLine);
+            png.decode(&iMismatches, 0);
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks `PNGAlpha()` against the masks `PNGRGB888Mask()` makes at thresholds 1 and 255 on every corpus line. Returns the mismatch count. */
+    int verifyAlpha() {
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, checkAlphaLine);
+            png.decode(&iMismatches, 0);
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks palette lookups via `PNGIndexes()` + `PNGPalette888Mask()` against `PNGRGB888Mask()` on every indexed corpus line. Returns the mismatch count. */
+    int verifyPaletteLookup() {
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, checkPaletteLookupLine);
+            png.decode(&iMismatches, 0);
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks `decodeLines()` in slices of a few sizes against one `decode()` on every corpus image. Returns the mismatch count. */
+    int verifyDecodeLines() {
+        static const int sliceLines[] = { 1, 5, 63, 64 };
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            LineCRC whole = { 0, 0 };
+            png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+            png.decode(&whole, 0);
+
+            for (size_t j = 0; j < sizeof(sliceLines)/sizeof(sliceLines[0]); j++) {
+                LineCRC sliced = { 0, 0 };
+                int rc, iCalls = 0;
+                png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+                while ((rc = png.decodeLines(&sliced, 0, sliceLines[j])) == PNG_DECODE_SUSPENDED) {
+                    iCalls++;
+                }
+                iMismatches += rc != PNG_SUCCESS || sliced.crc != whole.crc || sliced.lines != whole.lines
+                    || iCalls != (whole.lines - 1) / sliceLines[j] || png.isDecoding();
+            }
+        }
+
+        return iMismatches;
+    }
+
+    PNG<64, 4, 15> panelPng; // What main.cpp declares.
+    PNG<64, 4, 14> panelPng14;
+    PNG<64, 4, 13> panelPng13;
+    PNG<64, 4, 0>  framePng; // No window; only decodes into `frame`.
+    uint8_t frame[64 * (64*4 + 1)]; // `setBuffer()` target: a 64x64 RGBA image plus its filter bytes.
+
+    /* Decodes every image with `png` and `sized`. Returns how many `sized` decoded differently; `*pFailed` counts the ones it couldn't decode at all. */
+    int checkSized(PNGDecoder &sized, int *pFailed) {
+        const uint8_t *pImages[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iLens[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iImages = 0, iMismatches = 0;
+
+        pImages[iImages] = knockedtfout_png; iLens[iImages++] = (int)knockedtfout_png_len;
+        pImages[iImages] = test_card_png; iLens[iImages++] = (int)test_card_png_len;
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            pImages[iImages] = corpusImages[i].data; iLens[iImages++] = (int)*corpusImages[i].len;
+        }
+
+        *pFailed = 0;
+        for (int i = 0; i < iImages; i++) {
+            LineCRC full = { 0, 0 }, small = { 0, 0 };
+            png.openRAM((uint8_t *)pImages[i], iLens[i], crcLine);
+            png.decode(&full, 0);
+            if (sized.openRAM((uint8_t *)pImages[i], iLens[i], crcLine) != PNG_SUCCESS || sized.decode(&small, 0) != PNG_SUCCESS) {
+                (*pFailed)++;
+                continue;
+            }
+            iMismatches += small.crc != full.crc || small.lines != full.lines;
+        }
+
+        return iMismatches;
+    }
+
+    /* Prints what each decoder size costs in RAM and whether it decodes the images the same as `PNG<>`. Returns the mismatch count (images that failed outright aren't mismatches). */
+    int reportSizedDecoders() {
+        struct { const char *name; size_t size; PNGDecoder *pDecoder; } sizes[] = {
+            { "PNG<>",          sizeof(png),        &png },
+            { "PNG<64, 4, 15>", sizeof(panelPng),   &panelPng },
+            { "PNG<64, 4, 14>", sizeof(panelPng14), &panelPng14 },
+            { "PNG<64, 4, 13>", sizeof(panelPng13), &panelPng13 },
+        };
+        int iMismatches = 0;
+
+        printf("Decoder RAM (PNGIMAGE %zu + inflate_state %zu + window + line buffers):\n", sizeof(PNGIMAGE), sizeof(inflate_state));
+        for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+            int iFailed = 0, iDiffer = (i == 0) ? 0 : checkSized(*sizes[i].pDecoder, &iFailed);
+            printf("  %-15s %6zu bytes (%6ld vs PNG<>), %d images differ, %d failed\n",
+                sizes[i].name, sizes[i].size, (long)sizes[i].size - (long)sizes[0].size, iDiffer, iFailed);
+            iMismatches += iDiffer;
+        }
+        printf("  %-15s %6zu bytes + %zu byte frame buffer, setBuffer() decodes only\n", "PNG<64, 4, 0>", sizeof(framePng), sizeof(frame));
+
+        return iMismatches;
+    }
+
+    /* Opens each `corpusTooWide` image with `PNG<>` and main.cpp's `PNG<64, 4, 15>`. Their lines fit in 64*4 bytes, so only the width check stops them: each decoder must refuse the ones wider than it, and `PNG<>` must decode the rest. Returns the mismatch count. */
+    int verifyTooWide() {
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusTooWide)/sizeof(corpusTooWide[0]); i++) {
+            const CorpusWide *pWide = &corpusTooWide[i];
+
+            iMismatches += panelPng.openRAM(pWide->data, (int)*pWide->len, noopDraw) != PNG_TOO_BIG;
+            if (pWide->width > PNG_MAX_WIDTH) {
+                iMismatches += png.openRAM(pWide->data, (int)*pWide->len, noopDraw) != PNG_TOO_BIG;
+            } else {
+                iMismatches += png.openRAM(pWide->data, (int)*pWide->len, noopDraw) != PNG_SUCCESS || png.getWidth() != pWide->width || png.decode(NULL, 0) != PNG_SUCCESS;
+            }
+        }
+
+        return iMismatches;
+    }
+
+    enum { CONVERT_RGB565, CONVERT_RGB888, CONVERT_RGB888_THEN_MASK, CONVERT_RGB888_MASKED };
+
+    int maskMismatches;
+
+    uLong convertRows(int iConvert) {
+        PNGDRAW pngd;
+        uLong crc = 0;
+        int iRowLen = info.iPitch + 1;
+
+        pngd.iWidth = info.iWidth;
+        pngd.iPitch = info.iPitch;
+        pngd.iPixelType = info.ucPixelType;
+        pngd.iBpp = info.ucBpp;
+        pngd.iHasAlpha = png.hasAlpha();
+        pngd.pPalette = png.getPalette();
+        pngd.pFastPalette = NULL;
+        pngd.pUser = NULL;
+        for (int y = 0; y < info.iHeight; y++) {
+            pngd.y = y;
+            pngd.pPixels = &defiltered[y * iRowLen + 1];
+            switch (iConvert) {
+                case CONVERT_RGB565:
+                    PNGRGB565(&pngd, rgb565, PNG_RGB565_LITTLE_ENDIAN, 0xffffffff, pngd.iHasAlpha);
+                    crc = crc32(crc, (const Bytef *)rgb565, info.iWidth * sizeof(uint16_t));
+                    break;
+                case CONVERT_RGB888:
+                    PNGRGB888(&pngd, rgb888, 0xffffffff, pngd.iHasAlpha);
+                    crc = crc32(crc, rgb888, info.iWidth * 3);
+                    break;
+                case CONVERT_RGB888_THEN_MASK: // what `drawLineCallback` used to do
+                    PNGRGB888(&pngd, rgb888, 0, pngd.iHasAlpha);
+                    PNGMakeMask(&pngd, mask, 1);
+                    break;
+                case CONVERT_RGB888_MASKED:
+                    PNGRGB888Mask(&pngd, rgb888Fused, maskFused, 1, 0);
+                    break;
+            }
+        }
+
+        return crc;
+    }
+
+    /* Stand-in for an SD card file: PNG bytes in memory, with a fixed cost per read (command overhead) plus a cost per byte (transfer). */
+    struct ThrottledFile {
+        static const int nsPerRead = 150000; // Roughly a Teensy SDIO read command.
+        static const int nsPerKB   = 50000;  // Roughly 20 MB/s.
+
+        const uint8_t *pData;
+        uint32_t size, pos, reads;
+
+        bool seekSet(uint64_t position) {
+            pos = (position > size) ? size : (uint32_t)position;
+            return true;
+        }
+
+        int read(void *buf, size_t len) {
+            Clock::time_point start = Clock::now();
+            len = (len > size - pos) ? size - pos : len;
+            while (nsSince(start) < nsPerRead + (double)nsPerKB * len / 1024) {} // Spin, like a blocking SD read.
+            memcpy(buf, &pData[pos], len);
+            pos += len;
+            reads++;
+            return (int)len;
+        }
+    };
+
+    ThrottledFile throttled;
+    ReadAhead<ThrottledFile> readAhead;
+
+    void *openThrottled(const char *szFilename, int32_t *pFileSize) { (void)szFilename; *pFileSize = throttled.size; return &throttled; }
+    void closeThrottled(void *pHandle) { (void)pHandle; }
+    int32_t readDirect(PNGFILE *pFile, uint8_t *pBuf, int32_t iLen) { (void)pFile; return throttled.read(pBuf, iLen); }
+    int32_t readUnthrottled(PNGFILE *pFile, uint8_t *pBuf, int32_t iLen) {
+        (void)pFile;
+        iLen = (iLen > (int32_t)(throttled.size - throttled.pos)) ? (int32_t)(throttled.size - throttled.pos) : iLen;
+        memcpy(pBuf, &throttled.pData[throttled.pos], iLen);
+        throttled.pos += iLen;
+        return iLen;
+    }
+    int32_t seekDirect(PNGFILE *pFile, int32_t iPosition) { (void)pFile; throttled.seekSet(iPosition); return iPosition; }
+    int32_t readBuffered(PNGFILE *pFile, uint8_t *pBuf, int32_t iLen) { (void)pFile; return readAhead.read(pBuf, iLen); }
+    int32_t seekBuffered(PNGFILE *pFile, int32_t iPosition) { (void)pFile; readAhead.seek(iPosition); return iPosition; }
+
+    /* Decodes the open image into `frame` in slices of `iSliceLines`, then CRCs it the way `crcLine` does. Returns the decode's result. */
+    int decodeFrame(PNGDecoder &decoder, LineCRC *pCRC, int iSliceLines) {
+        int rc, iPitch = decoder.getBufferSize() / decoder.getHeight() - 1;
+
+        if (decoder.getBufferSize() > (int)sizeof(frame)) {
+            return PNG_TOO_BIG;
+        }
+        decoder.setBuffer(frame);
+        while ((rc = decoder.decodeLines(NULL, 0, iSliceLines)) == PNG_DECODE_SUSPENDED) { }
+        for (int y = 0; rc == PNG_SUCCESS && y < decoder.getHeight(); y++) {
+            pCRC->crc = crc32(pCRC->crc, (const Bytef *)&y, sizeof(y));
+            pCRC->crc = crc32(pCRC->crc, &frame[y * iPitch], iPitch);
+            pCRC->lines++;
+        }
+
+        return rc;
+    }
+
+    /* Checks `setBuffer()` decodes, whole and in slices, with and without a window, from memory and from a file, against line-by-line decodes. Returns the mismatch count. */
+    int verifyFrameBuffer() {
+        static const int sliceLines[] = { 1, 5, 64 };
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            LineCRC lines = { 0, 0 }, direct = { 0, 0 };
+            png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+            png.decode(&lines, 0);
+
+            for (size_t j = 0; j < sizeof(sliceLines)/sizeof(sliceLines[0]); j++) {
+                LineCRC windowed = { 0, 0 }, windowless = { 0, 0 };
+                png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, NULL);
+                iMismatches += decodeFrame(png, &windowed, sliceLines[j]) != PNG_SUCCESS || windowed.crc != lines.crc || windowed.lines != lines.lines;
+                framePng.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, NULL);
+                iMismatches += decodeFrame(framePng, &windowless, sliceLines[j]) != PNG_SUCCESS || windowless.crc != lines.crc || windowless.lines != lines.lines;
+            }
+
+            throttled.pData = corpusImages[i].data; // through ucFileBuf instead of in place
+            throttled.size = (uint32_t)*corpusImages[i].len;
+            throttled.pos = 0;
+            framePng.open("", openThrottled, closeThrottled, readUnthrottled, seekDirect, NULL);
+            iMismatches += decodeFrame(framePng, &direct, 5) != PNG_SUCCESS || direct.crc != lines.crc || direct.lines != lines.lines;
+        }
+
+        return iMismatches;
+    }
+
+    uint8_t inflated[64 * (64*4 + 1)];
+    uint8_t inflateOut[512 + 16]; // Each `inflate()` call's output space, then guard bytes it must not touch.
+
+    /* Inflates `iLen` bytes of zlib data at `pIn` into `inflated`, handing `inflate()` at most `iInStep` bytes of input and `iOutStep` bytes of output per call. Returns the bytes inflated, or `-1` if it failed or wrote past its output space. */
+    int inflateSteps(const uint8_t *pIn, int iLen, int iInStep, int iOutStep) {
+        z_stream d_stream;
+        struct inflate_state *state = (struct inflate_state *)zlibState;
+        int iOut = 0, err = Z_OK;
+
+        memset(&d_stream, 0, sizeof(d_stream));
+        d_stream.state = (struct internal_state *)state;
+        state->window = &zlibState[sizeof(inflate_state)];
+        inflateInit(&d_stream);
+        d_stream.next_in = (Bytef *)pIn;
+        while (err == Z_OK) {
+            if (d_stream.avail_in == 0) {
+                d_stream.avail_in = (iLen - (int)d_stream.total_in < iInStep) ? iLen - (int)d_stream.total_in : iInStep;
+            }
+            memset(inflateOut, 0xa5, sizeof(inflateOut));
+            d_stream.next_out = inflateOut;
+            d_stream.avail_out = iOutStep;
+            err = inflate(&d_stream, Z_NO_FLUSH, 0);
+            int iGot = iOutStep - (int)d_stream.avail_out;
+            for (int i = iOutStep; i < (int)sizeof(inflateOut); i++) {
+                if (inflateOut[i] != 0xa5) {
+                    err = Z_DATA_ERROR;
+                }
+            }
+            if (iOut + iGot > (int)sizeof(inflated)) {
+                err = Z_DATA_ERROR;
+            } else {
+                memcpy(&inflated[iOut], inflateOut, iGot);
+                iOut += iGot;
+            }
+            if (err == Z_BUF_ERROR && d_stream.avail_in == 0 && (int)d_stream.total_in < iLen) {
+                err = Z_OK; // wants the next slice of input
+            }
+        }
+        inflateEnd(&d_stream);
+        return (err == Z_STREAM_END) ? iOut : -1;
+    }
+
+    /* Inflates every corpus image's IDAT data with input and output in pieces of various sizes (rows like `DecodePNG()`, whole frames, a byte at a time). Returns how many didn't come out the length and CRC-32 that Python's zlib inflated them to. */
+    int verifyInflate() {
+        static const int steps[][2] = { { 1 << 17, 512 }, { 1 << 17, 257 }, { 1000, 17 }, { 7, 512 }, { 1, 1 }, { 33, 9 } };
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            int iIDATLen = gatherIDAT(corpusImages[i].data, (int)*corpusImages[i].len);
+            for (size_t j = 0; j < sizeof(steps)/sizeof(steps[0]); j++) {
+                int iOut = inflateSteps(idat, iIDATLen, steps[j][0], steps[j][1]);
+                iMismatches += iOut != (int)corpusImages[i].inflatedLen || crc32(0, inflated, iOut) != corpusImages[i].inflatedCRC;
+            }
+        }
+        return iMismatches;
+    }
+
+    PNG<>     cachedPng; // With `tables` as its Huffman table cache.
+    PNGTABLES tables[128]; // Room for every corpus image from memory and from a file.
+
+    /* Decodes every corpus image three times with the table cache (recording, then replaying), from memory, in slices and from a file, against an uncached decode. Prints how much of the cache the corpus used. Returns the mismatch count. */
+    int verifyTableCache() {
+        unsigned maxBlocks = 0, maxCodes = 0;
+        int iMismatches = 0, iReplayed = 0;
+
+        memset(tables, 0, sizeof(tables));
+        cachedPng.setTableCache(tables, (int)(sizeof(tables)/sizeof(tables[0])));
+        for (int iPass = 0; iPass < 3; iPass++) {
+            for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+                LineCRC plain = { 0, 0 }, memory = { 0, 0 }, sliced = { 0, 0 }, file = { 0, 0 };
+                png.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+                png.decode(&plain, 0);
+
+                cachedPng.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+                iMismatches += cachedPng.decode(&memory, 0) != PNG_SUCCESS || memory.crc != plain.crc || memory.lines != plain.lines;
+                cachedPng.openRAM(corpusImages[i].data, (int)*corpusImages[i].len, crcLine);
+                while (cachedPng.decodeLines(&sliced, 0, 5) == PNG_DECODE_SUSPENDED) { }
+                iMismatches += sliced.crc != plain.crc || sliced.lines != plain.lines;
+
+                throttled.pData = corpusImages[i].data;
+                throttled.size = (uint32_t)*corpusImages[i].len;
+                throttled.pos = 0;
+                cachedPng.open("", openThrottled, closeThrottled, readUnthrottled, seekDirect, crcLine);
+                iMismatches += cachedPng.decode(&file, 0) != PNG_SUCCESS || file.crc != plain.crc || file.lines != plain.lines;
+            }
+        }
+        for (size_t i = 0; i < sizeof(tables)/sizeof(tables[0]); i++) {
+            maxBlocks = (tables[i].replay.blocks > maxBlocks) ? tables[i].replay.blocks : maxBlocks;
+            maxCodes = (tables[i].replay.used > maxCodes) ? tables[i].replay.used : maxCodes;
+            iReplayed += tables[i].iHits > 1;
+        }
+        cachedPng.setTableCache(NULL, 0);
+
+        printf("Huffman table cache: %zu bytes per image, %d images replayed, using up to %u of %d blocks and %u of %d codes.\n",
+            sizeof(PNGTABLES), iReplayed, maxBlocks, REPLAY_BLOCKS, maxCodes, REPLAY_CODES);
+        return iMismatches;
+    }
+
+    /* Decodes every image from a throttled file, first with PNGdec's own reads, then through `ReadAhead` with `prefetch()` between 8-line slices (what `loop()` does). Prints time, file reads and stalls. Returns how many didn't match each other or an in-memory decode. */
+    int benchReadAhead() {
+        const uint8_t *pImages[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iLens[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iImages = 0, iMismatches = 0;
+        double nsDirect = 0, nsAhead = 0;
+        uint32_t readsDirect = 0, readsAhead = 0;
+
+        pImages[iImages] = knockedtfout_png; iLens[iImages++] = (int)knockedtfout_png_len;
+        pImages[iImages] = test_card_png; iLens[iImages++] = (int)test_card_png_len;
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            pImages[iImages] = corpusImages[i].data; iLens[iImages++] = (int)*corpusImages[i].len;
+        }
+
+        readAhead.stalls = readAhead.hits = 0;
+        for (int i = 0; i < iImages; i++) {
+            LineCRC direct = { 0, 0 }, ahead = { 0, 0 }, inPlace = { 0, 0 };
+            throttled.pData = pImages[i];
+            throttled.size = iLens[i];
+
+            throttled.pos = throttled.reads = 0; // a fresh open
+            Clock::time_point start = Clock::now();
+            png.open("", openThrottled, closeThrottled, readDirect, seekDirect, crcLine);
+            png.decode(&direct, 0);
+            nsDirect += nsSince(start);
+            readsDirect += throttled.reads;
+
+            throttled.reads = 0;
+            readAhead.invalidate();
+            readAhead.attach(&throttled, 0, throttled.size);
+            start = Clock::now();
+            png.open("", openThrottled, closeThrottled, readBuffered, seekBuffered, crcLine);
+            while (png.decodeLines(&ahead, 0, 8) == PNG_DECODE_SUSPENDED) {
+                readAhead.prefetch();
+            }
+            nsAhead += nsSince(start);
+            readsAhead += throttled.reads;
+
+            png.openRAM((uint8_t *)pImages[i], iLens[i], crcLine); // zero-copy path
+            png.decode(&inPlace, 0);
+
+            iMismatches += direct.crc != ahead.crc || direct.lines != ahead.lines || direct.crc != inPlace.crc || direct.lines != inPlace.lines;
+        }
+
+        printf("Throttled file, %d images: direct %.2f ms (%u reads), read-ahead %.2f ms (%u reads, %u stalls, %u hits).\n",
+            iImages, nsDirect / 1e6, readsDirect, nsAhead / 1e6, readsAhead, readAhead.stalls, readAhead.hits);
+        return iMismatches;
+    }
+
+    QOI<64>     qoi;
+    QOI<64, 16> qoiSmallBuffer; // Refills every few ops, to exercise the op-split-across-reads path.
+
+    /* CRCs a line the way `cacheLineCallback` sees it: RGB888 + mask, and the mask summary. */
+    void crcLine888(PNGDRAW *pDraw) {
+        LineCRC *pCRC = (LineCRC *)pDraw->pUser;
+        uint8_t rgb[64*3], mask[8];
+        uint8_t ucSummary = PNGRGB888Mask(pDraw, rgb, mask, 1, 0);
+
+        pCRC->crc = crc32(pCRC->crc, (const Bytef *)&pDraw->y, sizeof(pDraw->y));
+        pCRC->crc = crc32(pCRC->crc, rgb, pDraw->iWidth * 3);
+        pCRC->crc = crc32(pCRC->crc, mask, (pDraw->iWidth + 7) / 8);
+        pCRC->crc = crc32(pCRC->crc, &ucSummary, 1);
+        pCRC->lines++;
+    }
+
+    /* Decodes each corpus QOI whole, in slices, and through the throttled file with two buffer sizes, and checks each against the PNG of the same pixels. Truncated copies must fail cleanly. Returns the mismatch count. */
+    int verifyQOI() {
+        static const int sliceLines[] = { 1, 5, 64 };
+        static uint8_t truncated[1 << 15];
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusQOIs)/sizeof(corpusQOIs[0]); i++) {
+            const CorpusImage *pPNG = &corpusImages[corpusQOIs[i].png];
+            int iLen = (int)*corpusQOIs[i].len;
+            LineCRC ref = { 0, 0 }, whole = { 0, 0 }, file = { 0, 0 }, small = { 0, 0 };
+
+            png.openRAM(pPNG->data, (int)*pPNG->len, crcLine888);
+            png.decode(&ref, 0);
+
+            iMismatches += qoi.openRAM(corpusQOIs[i].data, iLen, crcLine888) != PNG_SUCCESS || qoi.decode(&whole, 0) != PNG_SUCCESS
+                || whole.crc != ref.crc || whole.lines != ref.lines || qoi.hasAlpha() != (strstr(corpusQOIs[i].name, "rgba") != NULL);
+
+            for (size_t j = 0; j < sizeof(sliceLines)/sizeof(sliceLines[0]); j++) {
+                LineCRC sliced = { 0, 0 };
+                int rc, iCalls = 0;
+                qoi.openRAM(corpusQOIs[i].data, iLen, crcLine888);
+                while ((rc = qoi.decodeLines(&sliced, 0, sliceLines[j])) == PNG_DECODE_SUSPENDED) {
+                    iCalls++;
+                }
+                iMismatches += rc != PNG_SUCCESS || sliced.crc != ref.crc || sliced.lines != ref.lines || iCalls != (ref.lines - 1) / sliceLines[j];
+            }
+
+            throttled.pData = corpusQOIs[i].data;
+            throttled.size = (uint32_t)iLen;
+            throttled.pos = 0;
+            qoi.open("", openThrottled, closeThrottled, readUnthrottled, seekDirect, crcLine888);
+            iMismatches += qoi.decode(&file, 0) != PNG_SUCCESS || file.crc != ref.crc || file.lines != ref.lines;
+            throttled.pos = 0;
+            qoiSmallBuffer.open("", openThrottled, closeThrottled, readUnthrottled, seekDirect, crcLine888);
+            iMismatches += qoiSmallBuffer.decode(&small, 0) != PNG_SUCCESS || small.crc != ref.crc || small.lines != ref.lines;
+
+            for (int iCut = 0; iCut < iLen - 8; iCut += 97) { // Everything but the end padding is needed.
+                LineCRC cut = { 0, 0 };
+                memcpy(truncated, corpusQOIs[i].data, iCut);
+                iMismatches += qoi.openRAM(truncated, iCut, crcLine888) == PNG_SUCCESS && qoi.decode(&cut, 0) == PNG_SUCCESS;
+            }
+        }
+
+        return iMismatches;
+    }
+
+    /* Times whole decodes of each corpus QOI against its PNG twin, both converted the way `cacheLineCallback` does. */
+    void benchQOI() {
+        for (size_t i = 0; i < sizeof(corpusQOIs)/sizeof(corpusQOIs[0]); i++) {
+            const CorpusImage *pPNG = &corpusImages[corpusQOIs[i].png];
+            LineCRC crc = { 0, 0 };
+
+            Clock::time_point start = Clock::now();
+            for (int j = 0; j < iterations; j++) {
+                qoi.openRAM(corpusQOIs[i].data, (int)*corpusQOIs[i].len, crcLine888);
+                qoi.decode(&crc, 0);
+            }
+            double nsQOI = nsSince(start) / iterations / 64;
+
+            start = Clock::now();
+            for (int j = 0; j < iterations; j++) {
+                png.openRAM(pPNG->data, (int)*pPNG->len, crcLine888);
+                png.decode(&crc, 0);
+            }
+            double nsPNG = nsSince(start) / iterations / 64;
+
+            printf("QOI %s (%u bytes) %.1f ns/row vs PNG %s (%u bytes) %.1f ns/row.\n",
+                corpusQOIs[i].name, *corpusQOIs[i].len, nsQOI, pPNG->name, *pPNG->len, nsPNG);
+        }
+    }
+
+    /* Checks `rgbToHsvRow()` against `rgbToHsv()` for every RGB color and `hsvToRgbRow()` against `hsvToRgb()` for every HSV triple, a 64-pixel row at a time, timing both. Returns the mismatch count. */
+    int verifyHsvRows() {
+        rgb24 rgb[64], rgbRow[64];
+        hsv24 hsv[64], hsvRow[64];
+        volatile uint8_t sink = 0; // Keeps the scalar loops from being optimised out.
+        double nsToHsv = 0, nsToHsvRow = 0, nsToRgb = 0, nsToRgbRow = 0;
+        int iMismatches = 0;
+
+        for (uint32_t c = 0; c < (1U << 24); c += 64) {
+            for (int i = 0; i < 64; i++) {
+                rgb[i].red = (c + i) >> 16;
+                rgb[i].green = (c + i) >> 8;
+                rgb[i].blue = c + i;
+                memcpy(&hsv[i], &rgb[i], 3); // The same 2^24 values as H, S, V.
+            }
+
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < 64; i++) {
+                hsv24 scalar = rgbToHsv(rgb[i]);
+                sink += scalar.h;
+                hsvRow[i] = scalar;
+            }
+            nsToHsv += nsSince(start);
+            start = Clock::now();
+            rgbToHsvRow(rgb, hsvRow, 64);
+            nsToHsvRow += nsSince(start);
+            for (int i = 0; i < 64; i++) {
+                hsv24 scalar = rgbToHsv(rgb[i]);
+                iMismatches += memcmp(&scalar, &hsvRow[i], 3) != 0;
+            }
+
+            start = Clock::now();
+            for (int i = 0; i < 64; i++) {
+                rgb24 scalar = hsvToRgb(hsv[i]);
+                sink += scalar.red;
+                rgbRow[i] = scalar;
+            }
+            nsToRgb += nsSince(start);
+            start = Clock::now();
+            hsvToRgbRow(hsv, rgbRow, 64);
+            nsToRgbRow += nsSince(start);
+            for (int i = 0; i < 64; i++) {
+                rgb24 scalar = hsvToRgb(hsv[i]);
+                iMismatches += memcmp(&scalar, &rgbRow[i], 3) != 0;
+            }
+        }
+
+        printf("HSV over all 2^24 inputs, ns/pixel: rgbToHsv %.2f, rgbToHsvRow %.2f, hsvToRgb %.2f, hsvToRgbRow %.2f.\n",
+            nsToHsv / (1 << 24), nsToHsvRow / (1 << 24), nsToRgb / (1 << 24), nsToRgbRow / (1 << 24));
+        return iMismatches;
+    }
+
+    ColorCache<rgb24> colorCache;
+    uint8_t bloom[256];
+    rgb24   sceneRows[64][64]; // An image's pixels, as `cacheLineCallback` would have them.
+
+    /* main.cpp's `effectRow()` through `bloom`, in the shape `ColorCache::apply()` takes. */
+    void bloomRow(const rgb24 *in, rgb24 *out, int count) {
+        effectRow(in, out, count, bloom);
+    }
+
+    void sceneLine(PNGDRAW *pDraw) {
+        PNGRGB888(pDraw, (uint8_t *)sceneRows[pDraw->y], 0, pDraw->iHasAlpha);
+    }
+
+    /* Blooms one image's rows 64 times over through `colorCache`, and returns the ns per pixel. Counts pixels that differ from `bloomRow()` into `*pMismatches`. */
+    double bloomScene(int *pMismatches) {
+        rgb24 cached[64], exact[64];
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < 64; i++) { // A still drawn for 64 frames.
+            for (int y = 0; y < 64; y++) {
+                colorCache.apply(sceneRows[y], cached, 64, bloomRow);
+            }
+        }
+        double ns = nsSince(start) / (64*64*64);
+
+        for (int y = 0; y < 64; y++) {
+            colorCache.apply(sceneRows[y], cached, 64, bloomRow);
+            bloomRow(sceneRows[y], exact, 64);
+            *pMismatches += memcmp(cached, exact, sizeof(exact)) != 0;
+        }
+        return ns;
+    }
+
+    /* Checks `buildBloomTable()` against the per-pixel float bloom it replaced, for every V and S value at every bloom scale the IR `bloomUp`/`bloomDown` steps reach. Returns the mismatch count. */
+    int verifyBloomTable() {
+        float   scales[64];
+        int     scaleCount = 1, iMismatches = 0;
+        uint8_t table[256];
+
+        scales[0] = 0.0;
+        for (int i = 0; i < scaleCount && scaleCount < 62; i++) { // Every scale reachable from `0.0`, stepping the way loop() does.
+            float next[2] = { scales[i] + bloomScaleStep, scales[i] + -bloomScaleStep };
+            bool  ok[2] = { scales[i] < bloomScaleMax, scales[i] > bloomScaleMin };
+            for (int j = 0; j < 2; j++) {
+                bool seen = !ok[j];
+                for (int k = 0; k < scaleCount && !seen; k++) {
+                    seen = scales[k] == next[j];
+                }
+                if (!seen) {
+                    scales[scaleCount++] = next[j];
+                }
+            }
+        }
+
+        for (int i = 0; i < scaleCount; i++) {
+            volatile float bloomScale = scales[i]; // Read per pixel, like the old `*pPriv->bloomScale`.
+            buildBloomTable(table, scales[i]);
+            for (int x = 0; x < 256; x++) {
+                hsv24 hsv24pixel = { 0, (unsigned char)x, (unsigned char)x };
+                hsv24pixel.v = hsv24pixel.v + (255 - hsv24pixel.v)*bloomScale;
+                hsv24pixel.s = hsv24pixel.s + (255 - hsv24pixel.s)*bloomScale;
+                iMismatches += table[x] != hsv24pixel.v || table[x] != hsv24pixel.s;
+            }
+        }
+        printf("Bloom table checked at %d IR bloom scales.\n", scaleCount);
+
+        return iMismatches;
+    }
+
+    /* Checks `colorCache` against `bloomRow()` over every RGB color (all misses, with evictions) and on the hardcoded images (mostly hits) at a few bloom scales, timing both. Returns the mismatch count. */
+    int verifyColorCache() {
+        static const float scales[] = { 0.25f, 0.5f, 0.9f };
+        const uint8_t *pImages[2] = { knockedtfout_png, test_card_png };
+        int iLens[2] = { (int)knockedtfout_png_len, (int)test_card_png_len };
+        rgb24 in[64], exact[64], cached[64];
+        int iMismatches = 0;
+
+        for (size_t k = 0; k < sizeof(scales)/sizeof(scales[0]); k++) {
+            double nsExact = 0, nsCached = 0;
+            buildBloomTable(bloom, scales[k]);
+            colorCache.clear();
+
+            for (uint32_t c = 0; c < (1U << 24); c += 64) {
+                for (int i = 0; i < 64; i++) {
+                    in[i].red = (c + i) >> 16;
+                    in[i].green = (c + i) >> 8;
+                    in[i].blue = c + i;
+                }
+                Clock::time_point start = Clock::now();
+                bloomRow(in, exact, 64);
+                nsExact += nsSince(start);
+                start = Clock::now();
+                colorCache.apply(in, cached, 64, bloomRow);
+                nsCached += nsSince(start);
+                iMismatches += memcmp(cached, exact, sizeof(exact)) != 0;
+            }
+            printf("Color cache, bloom %.2f: every color %.2f ns/pixel vs %.2f exact", scales[k], nsCached / (1 << 24), nsExact / (1 << 24));
+
+            for (int i = 0; i < 2; i++) {
+                memset(sceneRows, 0, sizeof(sceneRows));
+                png.openRAM((uint8_t *)pImages[i], iLens[i], sceneLine);
+                png.decode(NULL, 0);
+                colorCache.clear();
+                colorCache.hits = colorCache.misses = 0;
+                double ns = bloomScene(&iMismatches);
+                Clock::time_point start = Clock::now();
+                for (int j = 0; j < 64; j++) {
+                    for (int y = 0; y < 64; y++) {
+                        bloomRow(sceneRows[y], exact, 64);
+                    }
+                }
+                printf(", %s %.2f vs %.2f (%.1f%% hits)", (i == 0) ? "knockedtfout" : "test_card", ns, nsSince(start) / (64*64*64),
+                    100.0 * colorCache.hits / (colorCache.hits + colorCache.misses));
+            }
+            printf(".\n");
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks `Xoshiro128` against the reference xoshiro128++ outputs and for repeatable seeding, then `WeightedTable` against the `(2k + 1)/m²` distribution the old `sqrt(random(m²))` had, timing both ways. Returns the mismatch count. */
+    int verifyGlitchRandom() {
+        static const uint32_t expected[4] = { 0x00000281, 0x00180387, 0xc0183387, 0xd1ae3b02 }; // State `{ 1, 2, 3, 4 }`.
+        static const int magnitudes[] = { 3, 80 };
+        static WeightedTable<> table;
+        const int draws = 1 << 22;
+        int iMismatches = 0;
+
+        Xoshiro128 a = { { 1, 2, 3, 4 } }, b;
+        for (int i = 0; i < 4; i++) {
+            iMismatches += a.next() != expected[i];
+        }
+        a.seed(1);
+        b.seed(1);
+        for (int i = 0; i < 1000; i++) {
+            iMismatches += a.next() != b.next();
+        }
+
+        for (size_t k = 0; k < sizeof(magnitudes)/sizeof(magnitudes[0]); k++) {
+            int m = magnitudes[k];
+            static int counts[256];
+            volatile int sink = 0;
+            memset(counts, 0, sizeof(counts));
+            table.build(m);
+
+            Clock::time_point start = Clock::now();
+            for (int i = 0; i < draws; i++) {
+                counts[table.draw(a.next())]++;
+            }
+            double nsTable = nsSince(start) / draws;
+            start = Clock::now();
+            for (int i = 0; i < draws; i++) {
+                sink = sink + (int)(sqrt((uint32_t)(a.next() % (uint32_t)pow((float)m, 2.0)))); // The old `RAND_WEIGHTED()`.
+            }
+            double nsSqrt = nsSince(start) / draws;
+
+            double worst = 0;
+            for (int v = 0; v < m; v++) {
+                double want = (2.0*v + 1) / ((double)m*m);
+                double err = fabs((double)counts[v] / draws - want);
+                worst = (err > worst) ? err : worst;
+                iMismatches += err > 0.002; // Table slices are 1/1024 wide.
+            }
+            for (int v = m; v < 256; v++) {
+                iMismatches += counts[v] != 0;
+            }
+            printf("Weighted draws, magnitude %d: %.2f ns vs %.2f with sqrt, worst probability error %.5f.\n", m, nsTable, nsSqrt, worst);
+        }
+
+        return iMismatches;
+    }
+
+    /* Checks `mul255()` over every byte pair and `blendRow()` in each mode and a few opacities against rounded floating point on random premultiplied pixels, timing each. Returns the mismatch count. */
+    int verifyBlend() {
+        static const uint8_t opacities[] = { 255, 128, 37 };
+        static const char *names[BLEND_MODES] = { "over", "add", "screen" };
+        static void (* const blends[BLEND_MODES])(uint8_t *, const uint8_t *, const uint8_t *, int, uint8_t) = { blendRow<BLEND_OVER>, blendRow<BLEND_ADD>, blendRow<BLEND_SCREEN> };
+        const int rows = 4096;
+        static uint8_t src[rows][64*3], dst[rows][64*3], out[64*3], alpha[rows][64];
+        Xoshiro128 random;
+        int iMismatches = 0;
+
+        for (int x = 0; x < 256; x++) {
+            for (int y = 0; y < 256; y++) {
+                iMismatches += mul255(x, y) != lround(x*y/255.0);
+            }
+        }
+
+        random.seed(1);
+        for (int r = 0; r < rows; r++) {
+            for (int i = 0; i < 64; i++) {
+                alpha[r][i] = (random.next() & 1) ? 255 : random.next(); // Half opaque, like sprites.
+                for (int c = 0; c < 3; c++) {
+                    src[r][i*3 + c] = (random.next() % 256)*alpha[r][i] >> 8; // Premultiplied the way `PNGPut888()` does.
+                    dst[r][i*3 + c] = random.next();
+                }
+            }
+        }
+
+        printf("Blends, ns/pixel at opacity");
+        for (size_t k = 0; k < sizeof(opacities)/sizeof(opacities[0]); k++) {
+            printf(" %d:", opacities[k]);
+            for (int m = 0; m < BLEND_MODES; m++) {
+                double ns = 0;
+                for (int r = 0; r < rows; r++) {
+                    memcpy(out, dst[r], sizeof(out));
+                    Clock::time_point start = Clock::now();
+                    blends[m](out, src[r], alpha[r], 64, opacities[k]);
+                    ns += nsSince(start);
+
+                    for (int i = 0; i < 64; i++) {
+                        double o = opacities[k] / 255.0, a = lround(alpha[r][i]*o) / 255.0;
+                        for (int c = 0; c < 3; c++) {
+                            double s = lround(src[r][i*3 + c]*o), d = dst[r][i*3 + c], want;
+                            if (m == BLEND_OVER) {
+                                want = s + lround(d*(1 - a));
+                            } else if (m == BLEND_ADD) {
+                                want = s + d;
+                            } else {
+                                want = s + d - lround(s*d/255.0);
+                            }
+                            iMismatches += out[i*3 + c] != ((want > 255) ? 255 : want);
+                        }
+                    }
+                }
+                printf(" %s %.2f", names[m], ns / (rows*64));
+            }
+        }
+        printf(".\n");
+
+        return iMismatches;
+    }
+
+    struct StubLayer { // Stands in for SmartMatrix's background layer: a 64x64 back buffer with guard rows either side to catch stray writes.
+        static constexpr int guard = 2*64;
+        rgb24 pixels[guard + 64*64 + guard];
+
+        rgb24 *backBuffer() { return &pixels[guard]; }
+
+        /* Guard pixels that aren't `fill` any more. */
+        int strays(rgb24 fill) {
+            int n = 0;
+            for (int i = 0; i < guard; i++) {
+                n += memcmp(&pixels[i], &fill, 3) != 0;
+                n += memcmp(&pixels[guard + 64*64 + i], &fill, 3) != 0;
+            }
+            return n;
+        }
+    };
+    StubLayer stubLayer, stubReference;
+
+    /* Checks `blendSpan()` in each blend mode and `shiftRow()` against bounds-checked per-pixel references on `StubLayer`s, for runs and shifts landing on, across and past every edge. Returns the mismatch count. */
+    int verifySpans() {
+        static void (* const spans[BLEND_MODES])(rgb24 *, int, int, int, int, const rgb24 *, const uint8_t *, int, uint8_t) = { blendSpan<BLEND_OVER, rgb24>, blendSpan<BLEND_ADD, rgb24>, blendSpan<BLEND_SCREEN, rgb24> };
+        static void (* const rows[BLEND_MODES])(uint8_t *, const uint8_t *, const uint8_t *, int, uint8_t) = { blendRow<BLEND_OVER>, blendRow<BLEND_ADD>, blendRow<BLEND_SCREEN> };
+        static const int counts[] = { 0, 1, 7, 63, 64 };
+        const rgb24 guardColor = { 0xa5, 0x5a, 0xc3 };
+        rgb24   span[64];
+        uint8_t alpha[64];
+        Xoshiro128 random;
+        int iMismatches = 0, runs = 0;
+
+        random.seed(2);
+        for (int i = 0; i < 64; i++) {
+            alpha[i] = random.next();
+            span[i].red = (random.next() % 256)*alpha[i] >> 8;
+            span[i].green = (random.next() % 256)*alpha[i] >> 8;
+            span[i].blue = (random.next() % 256)*alpha[i] >> 8;
+        }
+
+        for (int m = 0; m < BLEND_MODES; m++) {
+            for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+                for (int y = -2; y < 66; y += 3) {
+                    for (int x = -70; x <= 70; x++) {
+                        fillSpan(stubLayer.pixels, sizeof(stubLayer.pixels)/sizeof(rgb24), guardColor);
+                        memcpy(stubReference.pixels, stubLayer.pixels, sizeof(stubLayer.pixels));
+
+                        spans[m](stubLayer.backBuffer(), 64, 64, x, y, span, alpha, counts[c], 200);
+                        for (int i = 0; i < counts[c]; i++) {
+                            if (x + i >= 0 && x + i < 64 && y >= 0 && y < 64) {
+                                rows[m]((uint8_t *)&stubReference.backBuffer()[y*64 + x + i], (const uint8_t *)&span[i], &alpha[i], 1, 200);
+                            }
+                        }
+                        iMismatches += memcmp(stubLayer.pixels, stubReference.pixels, sizeof(stubLayer.pixels)) != 0 || stubLayer.strays(guardColor);
+                        runs++;
+                    }
+                }
+            }
+        }
+
+        for (int shift = -70; shift <= 70; shift++) {
+            rgb24 *row = &stubLayer.backBuffer()[5*64], *ref = &stubReference.backBuffer()[5*64];
+            const rgb24 fill = { 1, 2, 3 };
+            fillSpan(stubLayer.pixels, sizeof(stubLayer.pixels)/sizeof(rgb24), guardColor);
+            memcpy(row, span, sizeof(span));
+            memcpy(stubReference.pixels, stubLayer.pixels, sizeof(stubLayer.pixels));
+
+            shiftRow(row, 64, shift, fill);
+            for (int x = 0; x < 64; x++) {
+                ref[x] = (x - shift >= 0 && x - shift < 64) ? span[x - shift] : fill;
+            }
+            iMismatches += memcmp(stubLayer.pixels, stubReference.pixels, sizeof(stubLayer.pixels)) != 0 || stubLayer.strays(guardColor);
+            runs++;
+        }
+        printf("Span blends and row shifts checked at %d positions.\n", runs);
+
+        return iMismatches;
+    }
+
+    FrameCache frameCache;
+
+    void frameCacheLine(PNGDRAW *pDraw) {
+        cacheLine(panelPng, pDraw, (FrameCache *)pDraw->pUser);
+    }
+
+    struct GuardedCache { FrameCache cache; uint8_t guard[256]; }; // Guard bytes catch rows written past the cache's end.
+
+    /* Decodes each `corpusTooWide` image `PNG<>` can open through `cacheLine()`, which must drop every line rather than write a row wider than the cache. Returns the mismatch count. */
+    int verifyWideCacheLines() {
+        static GuardedCache guarded;
+        static const uint8_t opaqueRows[64] = {0};
+        int iMismatches = 0;
+
+        for (size_t i = 0; i < sizeof(corpusTooWide)/sizeof(corpusTooWide[0]); i++) {
+            if (png.openRAM(corpusTooWide[i].data, (int)*corpusTooWide[i].len, frameCacheLine) != PNG_SUCCESS) {
+                continue; // Wider than `PNG<>` too; `verifyTooWide()` covers it.
+            }
+            memset(&guarded, 0xa5, sizeof(guarded));
+            clearCache(&guarded.cache);
+            iMismatches += png.decode(&guarded.cache, 0) != PNG_SUCCESS || memcmp(guarded.cache.rowOpacity, opaqueRows, sizeof(opaqueRows)) != 0;
+            for (size_t j = 0; j < sizeof(guarded.guard); j++) {
+                iMismatches += guarded.guard[j] != 0xa5;
+            }
+        }
+
+        return iMismatches;
+    }
+
+    /* Blends a whole `FrameCache` over `stubLayer`, the way `compose()` draws a layer without bloom. */
+    void blitFrameCache(const FrameCache *pCache) {
+        for (int y = 0; y < 64; y++) {
+            if (pCache->rowOpacity[y] & PNG_MASK_ANY_OPAQUE) {
+                blendSpan<BLEND_OVER>(stubLayer.backBuffer(), 64, 64, 0, y, pCache->pixels[y], pCache->alpha[y], 64, 255);
+            }
+        }
+    }
+
+    /* Times a frame of each hardcoded still both ways: decoded and converted into a `FrameCache` with main.cpp's decoder and then blitted, as every frame was before the cache, and only blitted from the cache. */
+    void benchFrameCache() {
+        const char    *names[2] = { "knockedtfout", "test_card" };
+        const uint8_t *pImages[2] = { knockedtfout_png, test_card_png };
+        int iLens[2] = { (int)knockedtfout_png_len, (int)test_card_png_len };
+
+        for (int i = 0; i < 2; i++) {
+            Clock::time_point start = Clock::now();
+            for (int j = 0; j < iterations; j++) {
+                clearCache(&frameCache);
+                panelPng.openRAM((uint8_t *)pImages[i], iLens[i], frameCacheLine);
+                if (panelPng.decode(&frameCache, 0) != PNG_SUCCESS) {
+                    break;
+                }
+                blitFrameCache(&frameCache);
+            }
+            double nsDecoded = nsSince(start) / iterations;
+            if (panelPng.getLastError() != PNG_SUCCESS) {
+                printf("Frame cache, %s: skipped (doesn't decode).\n", names[i]);
+                continue;
+            }
+
+            start = Clock::now();
+            for (int j = 0; j < iterations; j++) {
+                blitFrameCache(&frameCache);
+            }
+            double nsCached = nsSince(start) / iterations;
+            printf("Frame cache, %s: %.0f ns/frame decoding every frame vs %.0f ns/frame from the cache (%.0fx).\n", names[i], nsDecoded, nsCached, nsDecoded / nsCached);
+        }
+    }
+
+    /* Stands in for the SD card under the stub directory: sectors in memory, with a count of the reads, which are card commands and not filesystem calls. */
+    struct StubCard {
+        static const uint32_t sectorCount = 2048; // 1 MB.
+        uint8_t  data[sectorCount * 512];
+        uint32_t reads;
+
+        bool readSectors(uint32_t sector, uint8_t *dst, size_t ns) {
+            if (sector + ns > sectorCount) {
+                return false;
+            }
+            memcpy(dst, &data[sector * 512], ns * 512);
+            reads++;
+            return true;
+        }
+    };
+
+    struct StubEntry { char name[32]; uint32_t firstSector, size; bool fragmented; };
+
+    uint32_t stubFsCalls; // Every `StubFile` call, like every `FsFile` call on the Teensy, walks FAT structures.
+
+    /* Stands in for `FsFile`: the stub directory of `StubEntry`s on a `StubCard`, or one file in it. Files are contiguous on the card, but `fragmented` ones say otherwise, so they take the by-index path. */
+    struct StubFile {
+        StubCard  *card;
+        StubEntry *entries; // Set for the directory.
+        int        entryCount;
+        int        next; // `openNext()` position, for the directory.
+        StubEntry *entry; // Set while a file's open.
+        uint32_t   index; // `entry`'s, in its directory.
+        uint32_t   pos;
+
+        explicit operator bool() const { return entry || entries; }
+
+        bool open(StubFile *dir, uint32_t index, int oflag) {
+            (void)oflag;
+            stubFsCalls++;
+            card = dir->card;
+            entry = (index < (uint32_t)dir->entryCount) ? &dir->entries[index] : NULL;
+            this->index = index;
+            pos = 0;
+            return entry != NULL;
+        }
+        bool openNext(StubFile *dir, int oflag) {
+            stubFsCalls++;
+            return dir->next < dir->entryCount && open(dir, dir->next++, oflag);
+        }
+        bool close() { stubFsCalls++; entry = NULL; return true; }
+        size_t getName(char *name, size_t len) { stubFsCalls++; snprintf(name, len, "%s", entry->name); return strlen(name); }
+        uint32_t dirIndex() { stubFsCalls++; return index; }
+        uint64_t fileSize() { stubFsCalls++; return entry->size; }
+        bool contiguousRange(uint32_t *bgnSector, uint32_t *endSector) {
+            stubFsCalls++;
+            *bgnSector = entry->firstSector;
+            *endSector = entry->firstSector + (entry->size + 511) / 512 - 1;
+            return !entry->fragmented;
+        }
+        bool seekSet(uint64_t position) {
+            stubFsCalls++;
+            pos = (position > entry->size) ? entry->size : (uint32_t)position;
+            return true;
+        }
+        int read(void *buf, size_t len) {
+            stubFsCalls++;
+            len = (len > entry->size - pos) ? entry->size - pos : len;
+            memcpy(buf, &card->data[entry->firstSector * 512 + pos], len);
+            pos += len;
+            return (int)len;
+        }
+    };
+
+    typedef FrameSource<StubFile, StubCard> StubSource;
+
+    StubCard   stubCard;
+    StubEntry  stubEntries[96];
+    StubFile   stubDir, stubFrameFile;
+    uint32_t   stubNextSector = 1; // Sector `0` is the boot sector.
+    StubSource stubSource;
+    uint32_t   stubLen;
+    ReadAhead<StubSource> stubAhead;
+    FrameTable<StubFile, StubCard> frameTable;
+    FrameCache playedCache, referenceCache;
+
+    // What main.cpp's `SDC` callbacks do, on the stand-ins.
+    void *openStub(const char *szFilename, int32_t *pFileSize) {
+        (void)szFilename;
+        *pFileSize = stubLen;
+        stubAhead.attach(&stubSource, 0, stubLen); // Back to the start, past the magic `verifyFrameTable()` read.
+        return &stubSource;
+    }
+    void closeStub(void *pHandle) { (void)pHandle; if (!stubSource.bySector && stubFrameFile) { stubFrameFile.close(); } }
+    int32_t readStub(PNGFILE *pFile, uint8_t *pBuf, int32_t iLen) { (void)pFile; return stubAhead.read(pBuf, iLen); }
+    int32_t seekStub(PNGFILE *pFile, int32_t iPosition) { (void)pFile; stubAhead.seek(iPosition); return iPosition; }
+
+    /* Writes `len` bytes to the next free sectors of `stubCard` and lists them in the stub directory as `szName`. */
+    bool addStubFile(const char *szName, const uint8_t *pData, uint32_t len, bool fragmented) {
+        if (stubDir.entryCount >= (int)(sizeof(stubEntries)/sizeof(stubEntries[0])) || stubNextSector + (len + 511) / 512 > StubCard::sectorCount) {
+            return false;
+        }
+        StubEntry *pEntry = &stubEntries[stubDir.entryCount++];
+        snprintf(pEntry->name, sizeof(pEntry->name), "%s", szName);
+        pEntry->firstSector = stubNextSector;
+        pEntry->size = len;
+        pEntry->fragmented = fragmented;
+        memcpy(&stubCard.data[stubNextSector * 512], pData, len);
+        stubNextSector += (len + 511) / 512;
+        return true;
+    }
+
+    /* Decodes the frame `stubSource` points at into `playedCache` the way `Animation::poll()` does, 8 lines and a prefetch at a time, and the same bytes from memory into `referenceCache`. Returns whether they differ. */
+    template <typename Decoder>
+    int playFrame(Decoder &decoder, const uint8_t *pData, uint32_t len) {
+        memset(&playedCache, 0, sizeof(playedCache));
+        memset(&referenceCache, 0, sizeof(referenceCache));
+
+        int rc = decoder.open("", openStub, closeStub, readStub, seekStub, frameCacheLine);
+        if (rc == PNG_SUCCESS) {
+            while ((rc = decoder.decodeLines(&playedCache, 0, 8)) == PNG_DECODE_SUSPENDED) {
+                stubAhead.prefetch();
+            }
+        }
+        decoder.close();
+
+        int rcRef = decoder.openRAM((uint8_t *)pData, (int)len, frameCacheLine);
+        rcRef = (rcRef == PNG_SUCCESS) ? decoder.decode(&referenceCache, 0) : rcRef;
+        return rc != rcRef || memcmp(&playedCache, &referenceCache, sizeof(playedCache)) != 0;
+    }
+
+    /* Plays an animation twice from a stub directory of frame files through src/include/frametable.hpp, the way `Animation` does, and counts filesystem calls per frame: contiguous frames should take none, fragmented ones an open and their reads. The directory is out of order, with a `.qoi` twin for each corpus QOI, some files that aren't frames and a frame past a gap. Returns how many frames didn't decode the same as from memory, plus any wrong table entries. */
+    int verifyFrameTable() {
+        const uint8_t *pImages[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iLens[2 + sizeof(corpusImages)/sizeof(corpusImages[0])];
+        int iImages = 0, iMismatches = 0;
+        char szName[32];
+
+        pImages[iImages] = knockedtfout_png; iLens[iImages++] = (int)knockedtfout_png_len;
+        pImages[iImages] = test_card_png; iLens[iImages++] = (int)test_card_png_len;
+        for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+            pImages[iImages] = corpusImages[i].data; iLens[iImages++] = (int)*corpusImages[i].len;
+        }
+
+        stubDir.card = &stubCard;
+        stubDir.entries = stubEntries;
+        stubDir.entryCount = stubDir.next = 0;
+        stubNextSector = 1;
+        iMismatches += !addStubFile("readme.txt", (const uint8_t *)"not a frame", 11, false);
+        iMismatches += !addStubFile("anim.png", test_card_png, test_card_png_len, false);
+        iMismatches += !addStubFile("animation3.png", test_card_png, test_card_png_len, false);
+        for (int i = 0; i < iImages; i++) {
+            int iFrame = (i * 37) % iImages; // Out of order, like a directory that's been copied into a few times.
+            snprintf(szName, sizeof(szName), "anim%d.png", iFrame + 1);
+            iMismatches += !addStubFile(szName, pImages[iFrame], iLens[iFrame], iFrame % 5 == 4);
+        }
+        for (size_t i = 0; i < sizeof(corpusQOIs)/sizeof(corpusQOIs[0]); i++) { // After their PNGs, which they replace.
+            snprintf(szName, sizeof(szName), "anim%d.qoi", corpusQOIs[i].png + 3);
+            iMismatches += !addStubFile(szName, corpusQOIs[i].data, *corpusQOIs[i].len, i % 2);
+        }
+        snprintf(szName, sizeof(szName), "anim%d.png", iImages + 2);
+        iMismatches += !addStubFile(szName, test_card_png, test_card_png_len, false); // After a gap, so never played.
+
+        uint32_t calls = stubFsCalls;
+        iMismatches += frameTable.scan(&stubDir, "anim") != iImages;
+        uint32_t scanCalls = stubFsCalls - calls;
+        for (size_t i = 0; i < sizeof(corpusQOIs)/sizeof(corpusQOIs[0]); i++) {
+            iMismatches += !frameTable.frames[corpusQOIs[i].png + 2].isQOI;
+        }
+
+        uint32_t contiguousCalls = 0, fragmentedCalls = 0;
+        int contiguousFrames = 0, fragmentedFrames = 0;
+        stubCard.reads = 0;
+        for (int iPass = 0; iPass < 2; iPass++) {
+            for (int n = 1; n <= frameTable.count; n++) {
+                const StubEntry *pEntry = &stubEntries[frameTable.frames[n - 1].dirIndex];
+                uint8_t magic[4] = {0};
+
+                calls = stubFsCalls;
+                if (!frameTable.open(n, &stubDir, &stubFrameFile, &stubCard, &stubSource)) {
+                    iMismatches++;
+                    continue;
+                }
+                stubLen = frameTable.frames[n - 1].size;
+                stubAhead.invalidate(); // Same source, different file.
+                stubAhead.attach(&stubSource, 0, stubLen);
+                stubAhead.read(magic, sizeof(magic));
+                if (qoi.isQOI(magic)) {
+                    iMismatches += playFrame(qoi, &stubCard.data[pEntry->firstSector * 512], pEntry->size);
+                } else {
+                    iMismatches += playFrame(panelPng, &stubCard.data[pEntry->firstSector * 512], pEntry->size);
+                }
+
+                if (stubSource.bySector) {
+                    contiguousCalls += stubFsCalls - calls;
+                    contiguousFrames++;
+                } else {
+                    fragmentedCalls += stubFsCalls - calls;
+                    fragmentedFrames++;
+                }
+                iMismatches += stubSource.bySector == pEntry->fragmented;
+            }
+        }
+        iMismatches += contiguousCalls != 0;
+
+        printf("Frame table, %d frames played twice: scan %u filesystem calls, then %.1f per contiguous frame (%d) and %.1f per fragmented frame (%d), %.1f card reads per frame.\n",
+            frameTable.count, scanCalls, (double)contiguousCalls / (contiguousFrames ? contiguousFrames : 1), contiguousFrames,
+            (double)fragmentedCalls / (fragmentedFrames ? fragmentedFrames : 1), fragmentedFrames, (double)stubCard.reads / (contiguousFrames + fragmentedFrames));
+        return iMismatches;
+    }
+
+    void report(const char *stage, double ns) {
+        double nsPerRow = ns / iterations / info.iHeight;
+        double mbPerSec = ((double)info.iPitch * info.iHeight * iterations) / (ns / 1e9) / 1e6;
+
+        printf("  %-9s %9.1f ns/row %9.1f MB/s\n", stage, nsPerRow, mbPerSec);
+    }
+
+    void run(const char *name, uint8_t *pData, int iDataLen) {
+        memset(&info, 0, sizeof(info));
+        info.pfnRead = readRAM;
+        info.pfnSeek = seekMem;
+        info.PNGFile.iSize = iDataLen;
+        info.PNGFile.pData = pData;
+        info.iMaxWidth = 64;
+        info.iMaxPitch = 64*4;
+        if (PNGParseInfo(&info) != PNG_SUCCESS || info.iPitch * info.iHeight + info.iHeight > (int)sizeof(filtered)) {
+            printf("%s: skipped (unsupported or too big)\n", name);
+            return;
+        }
+
+        /* One real decode first, so the palette is loaded for color conversion. */
+        png.openRAM(pData, iDataLen, noopDraw);
+        png.decode(NULL, 0);
+
+        int iIDATLen = gatherIDAT(pData, iDataLen);
+        if (!inflateRows(iIDATLen)) {
+            printf("%s: skipped (inflate failed)\n", name);
+            return;
+        }
+
+        memcpy(defiltered, filtered, (info.iPitch + 1) * info.iHeight);
+        defilterRows(pfnDeFilterScalar);
+        uLong crcReference = crc32(0, defiltered, (info.iPitch + 1) * info.iHeight);
+        memcpy(defiltered, filtered, (info.iPitch + 1) * info.iHeight);
+        defilterRows(PNGDeFilterKernels(info.iWidth, info.iPitch));
+        uLong crcPixels = crc32(0, defiltered, (info.iPitch + 1) * info.iHeight);
+        uLong crcRGB565 = convertRows(CONVERT_RGB565);
+        uLong crcRGB888 = convertRows(CONVERT_RGB888);
+        printf("%s (type %d, %d bpp, %d bytes, crc %08lx/%08lx/%08lx)%s\n", name, info.ucPixelType, info.ucBpp, iDataLen, crcPixels, crcRGB565, crcRGB888, (crcPixels != crcReference) ? " DEFILTER MISMATCH" : "");
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            inflateRows(iIDATLen);
+        }
+        report("inflate", nsSince(start));
+
+        double ns = 0;
+        for (int i = 0; i < iterations; i++) {
+            memcpy(defiltered, filtered, (info.iPitch + 1) * info.iHeight); // DeFilter works in place
+            start = Clock::now();
+            defilterRows(PNGDeFilterKernels(info.iWidth, info.iPitch));
+            ns += nsSince(start);
+        }
+        report("defilter", ns);
+
+        ns = 0;
+        for (int i = 0; i < iterations; i++) {
+            memcpy(defiltered, filtered, (info.iPitch + 1) * info.iHeight);
+            start = Clock::now();
+            defilterRows(pfnDeFilterScalar);
+            ns += nsSince(start);
+        }
+        report("defilter0", ns);
+
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            convertRows(CONVERT_RGB565);
+        }
+        report("rgb565", nsSince(start));
+
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            convertRows(CONVERT_RGB888);
+        }
+        report("rgb888", nsSince(start));
+
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            convertRows(CONVERT_RGB888_THEN_MASK);
+        }
+        report("888,mask", nsSince(start));
+
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            convertRows(CONVERT_RGB888_MASKED);
+        }
+        report("888+mask", nsSince(start));
+
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            png.openRAM(pData, iDataLen, noopDraw);
+            png.decode(NULL, 0);
+        }
+        report("decode", nsSince(start));
+
+        PNGTABLES *pTables = &tables[0];
+        memset(pTables, 0, sizeof(*pTables));
+        cachedPng.setTableCache(pTables, 1);
+        start = Clock::now();
+        for (int i = 0; i < iterations; i++) { // the first one records, the rest replay
+            cachedPng.openRAM(pData, iDataLen, noopDraw);
+            cachedPng.decode(NULL, 0);
+        }
+        report("cached", nsSince(start));
+        cachedPng.setTableCache(NULL, 0);
+
+        if (info.iPitch <= 64*4) {
+            start = Clock::now();
+            for (int i = 0; i < iterations; i++) {
+                framePng.openRAM(pData, iDataLen, NULL);
+                framePng.setBuffer(frame);
+                framePng.decode(NULL, 0);
+            }
+            report("frame", nsSince(start));
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        BENCH::iterations = atoi(argv[1]) > 0 ? atoi(argv[1]) : BENCH::iterations;
+    }
+
+    printf("PNGdec stage benchmark, %d iterations per stage.\n", BENCH::iterations);
+    printf("Inflate (PNG_FAST_INFLATE=%d) vs Python's zlib: %d mismatches.\n", PNG_FAST_INFLATE, BENCH::verifyInflate());
+    printf("De-filter kernels vs scalar reference: %d mismatches.\n", BENCH::verifyDeFilterKernels());
+    printf("Packed line converters (PNG_PACKED_CONVERT=%d) vs per-byte loops: %d mismatches.\n", PNG_PACKED_CONVERT, BENCH::verifyPackedConverters());
+    printf("Fused RGB888 + mask vs separate passes: %d mismatches.\n", BENCH::verifyFusedMask());
+    printf("Palette lookup vs per-pixel RGB888 conversion: %d mismatches.\n", BENCH::verifyPaletteLookup());
+    printf("Alpha lines vs RGB888 masks: %d mismatches.\n", BENCH::verifyAlpha());
+    printf("Sliced decodeLines() vs one decode(): %d mismatches.\n", BENCH::verifyDecodeLines());
+    printf("Read-ahead and in-memory decodes vs direct reads: %d mismatches.\n", BENCH::benchReadAhead());
+    printf("Frame buffer decodes vs line by line: %d mismatches.\n", BENCH::verifyFrameBuffer());
+    printf("Table cache decodes vs uncached: %d mismatches.\n", BENCH::verifyTableCache());
+    printf("QOI decodes vs the same pixels as PNG: %d mismatches.\n", BENCH::verifyQOI());
+    printf("Sized decoders vs PNG<>: %d mismatches.\n", BENCH::reportSizedDecoders());
+    printf("Too-wide low-bpp images vs PNG_TOO_BIG: %d mismatches.\n", BENCH::verifyTooWide());
+    printf("Too-wide lines vs cacheLine()'s 64-pixel rows: %d mismatches.\n", BENCH::verifyWideCacheLines());
+    printf("HSV row conversions vs per pixel: %d mismatches.\n", BENCH::verifyHsvRows());
+    printf("Bloom table vs per-pixel float bloom: %d mismatches.\n", BENCH::verifyBloomTable());
+    printf("Color cache vs exact bloom: %d mismatches.\n", BENCH::verifyColorCache());
+    printf("Glitch randoms vs xoshiro128++ and the weighted distribution: %d mismatches.\n", BENCH::verifyGlitchRandom());
+    printf("Blend modes vs floating point: %d mismatches.\n", BENCH::verifyBlend());
+    printf("Clipped span blends and row shifts vs per pixel: %d mismatches.\n", BENCH::verifySpans());
+    printf("Frame table playback vs in-memory decodes: %d mismatches.\n", BENCH::verifyFrameTable());
+    BENCH::benchQOI();
+    BENCH::benchFrameCache();
+    printf("\n");
+
+    BENCH::run("knockedtfout", knockedtfout_png, (int)knockedtfout_png_len);
+    BENCH::run("test_card", test_card_png, (int)test_card_png_len);
+    for (size_t i = 0; i < sizeof(corpusImages)/sizeof(corpusImages[0]); i++) {
+        BENCH::run(corpusImages[i].name, corpusImages[i].data, (int)*corpusImages[i].len);
+    }
+
+    return 0;
+}
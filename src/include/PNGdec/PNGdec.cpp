@@ -24,16 +24,52 @@
 // forward references
 PNG_STATIC int PNGInit(PNGIMAGE *pPNG);
 PNG_STATIC int DecodePNG(PNGIMAGE *pImage, void *pUser, int iOptions);
+PNG_STATIC int DecodePNGLines(PNGIMAGE *pImage, void *pUser, int iOptions, int iMaxLines);
 PNG_STATIC uint8_t PNGMakeMask(PNGDRAW *pDraw, uint8_t *pMask, uint8_t ucThreshold);
 // Include the C code which does the actual work
 #include "png.inl"
 
 //
-// Memory initialization
+// The buffers belong to the PNG<> template, sized by its parameters
+//
+PNGDecoder::PNGDecoder(uint8_t *pZLIB, int iWindowBits, uint8_t *pPixels, int iPixelsSize, int iMaxWidth, int iMaxPitch)
+{
+    memset(&_png, 0, sizeof(PNGIMAGE));
+    _png.pZLIB = pZLIB;
+    _png.iWindowBits = iWindowBits;
+    _png.pPixels = pPixels;
+    _png.iPixelsSize = iPixelsSize;
+    _png.iMaxWidth = iMaxWidth;
+    _png.iMaxPitch = iMaxPitch;
+} /* PNGDecoder() */
+//
+// Clear the image state before opening a new one; the buffers stay
 //
-int PNG::openRAM(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
+void PNGDecoder::reset()
 {
+    uint8_t *pZLIB = _png.pZLIB, *pPixels = _png.pPixels;
+    int iWindowBits = _png.iWindowBits, iPixelsSize = _png.iPixelsSize, iMaxWidth = _png.iMaxWidth, iMaxPitch = _png.iMaxPitch;
+    PNGTABLES *pTables = _png.pTables;
+    int iTableCount = _png.iTableCount, iTableNext = _png.iTableNext;
+
     memset(&_png, 0, sizeof(PNGIMAGE));
+    _png.pZLIB = pZLIB;
+    _png.iWindowBits = iWindowBits;
+    _png.pPixels = pPixels;
+    _png.iPixelsSize = iPixelsSize;
+    _png.iMaxWidth = iMaxWidth;
+    _png.iMaxPitch = iMaxPitch;
+    _png.pTables = pTables;
+    _png.iTableCount = iTableCount;
+    _png.iTableNext = iTableNext;
+} /* reset() */
+
+//
+// Memory initialization
+//
+int PNGDecoder::openRAM(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
+{
+    reset();
     _png.ucMemType = PNG_MEM_RAM;
     _png.pfnRead = readRAM;
     _png.pfnSeek = seekMem;
@@ -47,9 +83,9 @@ int PNG::openRAM(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
 //
 // It's necessary to separate out a FLASH version on Harvard architecture machines
 //
-int PNG::openFLASH(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
+int PNGDecoder::openFLASH(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
 {
-    memset(&_png, 0, sizeof(PNGIMAGE));
+    reset();
     _png.ucMemType = PNG_MEM_FLASH;
     _png.pfnRead = readFLASH;
     _png.pfnSeek = seekMem;
@@ -64,9 +100,9 @@ int PNG::openFLASH(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw)
 //
 // File (SD/MMC) based initialization
 //
-int PNG::open(const char *szFilename, PNG_OPEN_CALLBACK *pfnOpen, PNG_CLOSE_CALLBACK *pfnClose, PNG_READ_CALLBACK *pfnRead, PNG_SEEK_CALLBACK *pfnSeek, PNG_DRAW_CALLBACK *pfnDraw)
+int PNGDecoder::open(const char *szFilename, PNG_OPEN_CALLBACK *pfnOpen, PNG_CLOSE_CALLBACK *pfnClose, PNG_READ_CALLBACK *pfnRead, PNG_SEEK_CALLBACK *pfnSeek, PNG_DRAW_CALLBACK *pfnDraw)
 {
-    memset(&_png, 0, sizeof(PNGIMAGE));
+    reset();
     _png.pfnRead = pfnRead;
     _png.pfnSeek = pfnSeek;
     _png.pfnDraw = pfnDraw;
@@ -81,7 +117,7 @@ int PNG::open(const char *szFilename, PNG_OPEN_CALLBACK *pfnOpen, PNG_CLOSE_CALL
 //
 // return the last error (if any)
 //
-int PNG::getLastError()
+int PNGDecoder::getLastError()
 {
     return _png.iError;
 } /* getLastError() */
@@ -89,7 +125,7 @@ int PNG::getLastError()
 // Get the width of the image in pixels
 // can be called after opening the file (before decoding)
 //
-int PNG::getWidth()
+int PNGDecoder::getWidth()
 {
     return _png.iWidth;
 } /* getWidth() */
@@ -97,7 +133,7 @@ int PNG::getWidth()
 // Get the height of the image in pixels
 // can be called after opening the file (before decoding)
 //
-int PNG::getHeight()
+int PNGDecoder::getHeight()
 {
     return _png.iHeight;
 } /* getHeight() */
@@ -105,7 +141,7 @@ int PNG::getHeight()
 // For truecolor and palette images, it's possible to have a single
 // transparent color defined. This call will return it if defined
 //
-uint32_t PNG::getTransparentColor()
+uint32_t PNGDecoder::getTransparentColor()
 {
     return _png.iTransparent;
 } /* getTransparentColor() */
@@ -114,7 +150,7 @@ uint32_t PNG::getTransparentColor()
 // depending on the PNG pixel type of the image
 // This call simply tells you if there is alpha for the current pixel type
 //
-int PNG::hasAlpha()
+int PNGDecoder::hasAlpha()
 {
     return _png.iHasAlpha;
 } /* hasAlpha() */
@@ -123,7 +159,7 @@ int PNG::hasAlpha()
 // This option is not supported by the decoder, but after opening the image
 // you can determine if it's set
 //
-int PNG::isInterlaced()
+int PNGDecoder::isInterlaced()
 {
     return _png.iInterlaced;
 } /* isInterlaced() */
@@ -132,52 +168,69 @@ int PNG::isInterlaced()
 // Returns the number of bits per color stimulus
 // values of 1,2,4, and 8 are supported
 //
-int PNG::getBpp()
+int PNGDecoder::getBpp()
 {
     return (int)_png.ucBpp;
 } /* getBpp() */
 //
 // Returns the PNG pixel type (see enum in PNGdec.h)
 //
-int PNG::getPixelType()
+int PNGDecoder::getPixelType()
 {
     return (int)_png.ucPixelType;
 } /* getPixelType() */
 //
-// Set the image buffer to memory managed by the caller
+// Set the image buffer to memory managed by the caller (call after opening)
 // If set, decode() will not use the PNGDRAW callback function
 // and instead write the image into this buffer in one shot
+// The buffer doubles as the zlib window, so it must be getBufferSize() bytes
+// (a filter byte more per line than the image); the decoded image is packed
+// at y * pitch. This is the only mode a PNG<w, bpp, 0> (no window) can decode in
 //
-void PNG::setBuffer(uint8_t *pBuffer)
+void PNGDecoder::setBuffer(uint8_t *pBuffer)
 {
     _png.pImage = pBuffer;
 } /* setBuffer() */
 //
+// Keep the Huffman tables of up to iCount recently decoded images in pTables
+// (zeroed by the caller), so decoding one of them again skips rebuilding them
+// Images are told apart by where they are in memory (files all count as the
+// same place), their size and the CRC of their first IDAT chunk
+// Set to NULL to stop caching
+//
+void PNGDecoder::setTableCache(PNGTABLES *pTables, int iCount)
+{
+    _png.pTables = pTables;
+    _png.iTableCount = (pTables == NULL) ? 0 : iCount;
+    _png.iTableNext = 0;
+} /* setTableCache() */
+//
 // Returns the previously set image buffer or NULL if there is none
 //
-uint8_t * PNG::getBuffer()
+uint8_t * PNGDecoder::getBuffer()
 {
     return _png.pImage;
 } /* getBuffer() */
 //
 // Returns the size in bytes of the buffer needed to hold the uncompressed image
+// (with its filter bytes; see setBuffer())
 //
-int PNG::getBufferSize()
+int PNGDecoder::getBufferSize()
 {
-    return _png.iHeight * _png.iPitch;
+    return _png.iHeight * (_png.iPitch + 1);
 } /* getBufferSize() */
 //
 // Returns a pointer to the palette
 // If there is alpha info for the palette, it starts at pPalette[768]
 //
-uint8_t * PNG::getPalette()
+uint8_t * PNGDecoder::getPalette()
 {
     return _png.ucPalette;
 } /* getPalette() */
 //
 // Close the file - not needed when decoding from memory
 //
-void PNG::close()
+void PNGDecoder::close()
 {
     if (_png.pfnClose)
         (*_png.pfnClose)(_png.PNGFile.fHandle);
@@ -189,21 +242,82 @@ void PNG::close()
 // 0 = PNG_SUCCESS
 // non 0 = PNG enumerated error code
 //
-int PNG::decode(void *pUser, int iOptions)
+int PNGDecoder::decode(void *pUser, int iOptions)
 {
     return DecodePNG(&_png, pUser, iOptions);
 } /* decode() */
 //
+// Decode at most iMaxLines lines, then return so the caller can do other work
+// returns PNG_DECODE_SUSPENDED if there's more to do; call again to resume where it
+// stopped (pUser/iOptions only apply to the first call of each image)
+// Nothing else may use this object (or its file) until the decode finishes
+// or the image is re-opened
+//
+int PNGDecoder::decodeLines(void *pUser, int iOptions, int iMaxLines)
+{
+    return DecodePNGLines(&_png, pUser, iOptions, iMaxLines);
+} /* decodeLines() */
+//
+// returns 1 if a decodeLines() decode is suspended part-way through the image
+//
+int PNGDecoder::isDecoding()
+{
+    return _png.dec.bSuspended;
+} /* isDecoding() */
+//
 // Convert a line of native pixels (all supported formats) into RGB565
 // can optionally mix in a background color - set to -1 to disable
 // Background color is in the form of a uint32_t -> 00BBGGRR (MSB on left)
 //
-void PNG::getLineAsRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndianness, uint32_t u32Bkgd)
+void PNGDecoder::getLineAsRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndianness, uint32_t u32Bkgd)
 {
     PNGRGB565(pDraw, pPixels, iEndianness, u32Bkgd, hasAlpha());
 } /* getLineAsRGB565() */
+//
+// Convert a line of native pixels (all supported formats) into RGB888
+// 3 bytes per pixel in R,G,B order (the same layout as SmartMatrix's rgb24)
+// Background color works the same as getLineAsRGB565(); 0xffffffff ignores
+// alpha and 0 (black) gives premultiplied alpha
+//
+void PNGDecoder::getLineAsRGB888(PNGDRAW *pDraw, uint8_t *pPixels, uint32_t u32Bkgd)
+{
+    PNGRGB888(pDraw, pPixels, u32Bkgd, pDraw->iHasAlpha);
+} /* getLineAsRGB888() */
+//
+// getLineAsRGB888() and getAlphaMask() fused into a single pass over the line
+// Returns PNG_MASK_ANY_OPAQUE if any mask bit is set and PNG_MASK_ALL_OPAQUE
+// if every pixel is, so callers can skip empty lines or skip the mask test
+//
+uint8_t PNGDecoder::getLineAsRGB888Masked(PNGDRAW *pDraw, uint8_t *pPixels, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd)
+{
+    return PNGRGB888Mask(pDraw, pPixels, pMask, ucThreshold, u32Bkgd);
+} /* getLineAsRGB888Masked() */
+//
+// Unpack an indexed line to one palette index per byte
+// returns 0 if the image isn't indexed
+//
+int PNGDecoder::getLineAsIndexes(PNGDRAW *pDraw, uint8_t *pIndexes)
+{
+    return PNGIndexes(pDraw, pIndexes);
+} /* getLineAsIndexes() */
+//
+// One alpha byte per pixel, to go with a getLineAsRGB888*() line converted
+// with a background of 0 (premultiplied); returns 1 if the line is fully opaque
+//
+int PNGDecoder::getLineAsAlpha(PNGDRAW *pDraw, uint8_t *pAlpha)
+{
+    return PNGAlpha(pDraw, pAlpha);
+} /* getLineAsAlpha() */
+//
+// Convert the palette to RGB888 + alpha mask, matching getLineAsRGB888Masked()
+// returns 0 if the image isn't indexed
+//
+int PNGDecoder::getPaletteAsRGB888Masked(PNGDRAW *pDraw, uint8_t *pPalette, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd)
+{
+    return PNGPalette888Mask(pDraw, pPalette, pMask, ucThreshold, u32Bkgd);
+} /* getPaletteAsRGB888Masked() */
 
-uint8_t PNG::getAlphaMask(PNGDRAW *pDraw, uint8_t *pMask, uint8_t ucThreshold)
+uint8_t PNGDecoder::getAlphaMask(PNGDRAW *pDraw, uint8_t *pMask, uint8_t ucThreshold)
 {
     return PNGMakeMask(pDraw, pMask, ucThreshold);
 } /* getAlphaMask() */
@@ -48,9 +48,13 @@
 #endif
 /* Defines and variables */
 #define PNG_FILE_BUF_SIZE 2048
-// Number of bytes to reserve for current and previous lines
-// Defaults to 480 32-bit pixels max width
-#define PNG_MAX_BUFFERED_PIXELS ((480*4 + 1)*2)
+// Default size limits of the PNG<> class (480 32-bit pixels max width, 32k window)
+#define PNG_MAX_WIDTH 480
+#define PNG_MAX_BYTES_PER_PIXEL 4
+#define PNG_WINDOW_BITS 15
+// Bytes to reserve for the current and previous lines (each 16-byte aligned,
+// plus its filter byte) and the 256-entry RGB565 fast palette after them
+#define PNG_PIXELS_SIZE(iMaxPitch) (((iMaxPitch) + 32) * 2 + 512)
 // PNG filter type
 enum {
     PNG_FILTER_NONE=0,
@@ -75,6 +79,12 @@ enum {
     PNG_PIXEL_GRAY_ALPHA=4,
     PNG_PIXEL_TRUECOLOR_ALPHA=6
 };
+// line opacity summary returned by getLineAsRGB888Masked()
+enum {
+    PNG_MASK_ANY_OPAQUE = 1,
+    PNG_MASK_ALL_OPAQUE = 2
+};
+
 // RGB565 endianness
 enum {
     PNG_RGB565_LITTLE_ENDIAN = 0,
@@ -95,7 +105,8 @@ enum {
     PNG_NO_BUFFER,
     PNG_UNSUPPORTED_FEATURE,
     PNG_INVALID_FILE,
-    PNG_TOO_BIG
+    PNG_TOO_BIG,
+    PNG_DECODE_SUSPENDED // not an error; decodeLines() stopped early and the next call resumes
 };
 
 typedef struct png_draw_tag
@@ -127,6 +138,32 @@ typedef void * (PNG_OPEN_CALLBACK)(const char *szFilename, int32_t *pFileSize);
 typedef void (PNG_DRAW_CALLBACK)(PNGDRAW *);
 typedef void (PNG_CLOSE_CALLBACK)(void *pHandle);
 
+//
+// DecodePNG() locals saved by decodeLines() so a decode can be resumed
+//
+typedef struct png_decode_tag
+{
+    z_stream d_stream; // zlib checks that this doesn't move between calls
+    void *pUser;
+    int iOptions;
+    int bSuspended;
+    int y, iLen, bDone, iOffset, iFileOffset, iBytesRead, iMarker;
+    uint8_t *pCurr, *pPrev;
+    uint8_t *s; // ucFileBuf, or the current chunk of a memory source
+} PNGDECODE;
+
+//
+// Huffman tables of one image, kept between decodes (see setTableCache())
+//
+typedef struct png_tables_tag
+{
+    uint8_t *pData; // memory source the image was in (NULL for a file)
+    int32_t iSize; // its size; 0 if this entry is unused
+    uint32_t u32CRC; // CRC of its first IDAT chunk
+    int iHits; // lives left; an entry at 0 can be given to another image
+    inflate_replay replay;
+} PNGTABLES;
+
 //
 // our private structure to hold a JPEG image decode state
 //
@@ -147,18 +184,27 @@ typedef struct png_image_tag
     PNG_DRAW_CALLBACK *pfnDraw;
     PNG_CLOSE_CALLBACK *pfnClose;
     PNGFILE PNGFile;
-    uint8_t ucZLIB[32768 + sizeof(inflate_state)]; // put this here to avoid needing malloc/free
+    PNGDECODE dec; // saved state of a suspended decodeLines()
+    uint8_t *pZLIB; // inflate_state + window; owned by PNG<> to avoid needing malloc/free
+    int iWindowBits; // window is (1 << iWindowBits) bytes
+    uint8_t *pPixels; // current + previous line and fast palette; owned by PNG<>
+    int iPixelsSize;
+    int iMaxWidth; // widest image the caller's line buffers are sized for
+    int iMaxPitch; // longest line pPixels can hold
+    PNGTABLES *pTables; // Huffman table cache, or NULL
+    int iTableCount, iTableNext;
     uint8_t ucPalette[1024];
-    uint8_t ucPixels[PNG_MAX_BUFFERED_PIXELS * 2];
     uint8_t ucFileBuf[PNG_FILE_BUF_SIZE]; // holds temp file data
 } PNGIMAGE;
 
 #ifdef __cplusplus
 #define PNG_STATIC static
 //
-// The PNG class wraps portable C code which does the actual work
+// The PNGDecoder class wraps portable C code which does the actual work
+// Declare one as PNG<> (or PNG<iMaxWidth, iMaxBytesPerPixel, iWindowBits>),
+// which also holds the buffers sized to those limits
 //
-class PNG
+class PNGDecoder
 {
   public:
     int openRAM(uint8_t *pData, int iDataSize, PNG_DRAW_CALLBACK *pfnDraw);
@@ -166,6 +212,8 @@ class PNG
     int open(const char *szFilename, PNG_OPEN_CALLBACK *pfnOpen, PNG_CLOSE_CALLBACK *pfnClose, PNG_READ_CALLBACK *pfnRead, PNG_SEEK_CALLBACK *pfnSeek, PNG_DRAW_CALLBACK *pfnDraw);
     void close();
     int decode(void *pUser, int iOptions);
+    int decodeLines(void *pUser, int iOptions, int iMaxLines);
+    int isDecoding();
     int getWidth();
     int getHeight();
     int getBpp();
@@ -178,12 +226,44 @@ class PNG
     int getBufferSize();
     uint8_t *getBuffer();
     void setBuffer(uint8_t *pBuffer);
+    void setTableCache(PNGTABLES *pTables, int iCount);
     uint8_t getAlphaMask(PNGDRAW *pDraw, uint8_t *pMask, uint8_t ucThreshold);
     void getLineAsRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndianness, uint32_t u32Bkgd);
+    void getLineAsRGB888(PNGDRAW *pDraw, uint8_t *pPixels, uint32_t u32Bkgd);
+    uint8_t getLineAsRGB888Masked(PNGDRAW *pDraw, uint8_t *pPixels, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd);
+    int getLineAsIndexes(PNGDRAW *pDraw, uint8_t *pIndexes);
+    int getLineAsAlpha(PNGDRAW *pDraw, uint8_t *pAlpha);
+    int getPaletteAsRGB888Masked(PNGDRAW *pDraw, uint8_t *pPalette, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd);
+
+  protected:
+    PNGDecoder(uint8_t *pZLIB, int iWindowBits, uint8_t *pPixels, int iPixelsSize, int iMaxWidth, int iMaxPitch);
 
   private:
+    void reset();
     PNGIMAGE _png;
 };
+//
+// Decoder with buffers for images up to iMaxWidth pixels of iMaxBytesPerPixel
+// (4 = 8-bit RGBA, 8 = 16-bit RGBA) and a (1 << iWindowBits) byte inflate window
+// Wider images, or lines longer than iMaxWidth * iMaxBytesPerPixel, fail to open
+// with PNG_TOO_BIG. A window smaller than the one the image was compressed with
+// works as long as no match reaches back further than it
+// (always true if the whole inflated image, (pitch+1) * height, fits in the window);
+// otherwise decoding stops with PNG_DECODE_ERROR
+// iWindowBits = 0 leaves the window out; then it only decodes into setBuffer()
+//
+template <int iMaxWidth = PNG_MAX_WIDTH, int iMaxBytesPerPixel = PNG_MAX_BYTES_PER_PIXEL, int iWindowBits = PNG_WINDOW_BITS>
+class PNG : public PNGDecoder
+{
+    static_assert(iWindowBits == 0 || (iWindowBits >= 8 && iWindowBits <= 15), "zlib windows are 256 bytes to 32k");
+
+  public:
+    PNG() : PNGDecoder(_ucZLIB, iWindowBits, _ucPixels, sizeof(_ucPixels), iMaxWidth, iMaxWidth * iMaxBytesPerPixel) {}
+
+  private:
+    uint8_t _ucZLIB[sizeof(inflate_state) + (iWindowBits ? 1 << iWindowBits : 0)] __attribute__((aligned(16)));
+    uint8_t _ucPixels[PNG_PIXELS_SIZE(iMaxWidth * iMaxBytesPerPixel)] __attribute__((aligned(16)));
+};
 #else
 #define PNG_STATIC
 int PNG_openRAM(PNGIMAGE *pPNG, uint8_t *pData, int iDataSize);
@@ -10,7 +10,7 @@
 
 #ifdef ASMINF
 #  pragma message("Assembler code may have bugs -- use at your own risk")
-#else
+#elif !PNG_FAST_INFLATE /* PNGdec: else it's in inffast_wide.c */
 
 #if ((INTPTR_MAX == INT64_MAX) || defined(HAL_ESP32_HAL_H_) || defined(TEENSYDUINO) || defined(ARM_MATH_CM4) || defined(ARM_MATH_CM7)) && !defined(ARDUINO_ARCH_RP2040)
 #define ALLOWS_UNALIGNED
@@ -239,13 +239,19 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
 #ifdef ALLOWS_UNALIGNED
                     {
                     uint8_t *pEnd = out+len;
+                        // PNGdec: the rest of the match can come from just behind out
+                        // (it only started in the window), so check the overlap here too,
+                        // and don't write past pEnd, which can be the end of the output
+                        if ((uintptr_t)(out - from) >= 4) {
+                            while (out < pEnd-3) {
+                                *(uint32_t *)out = *(uint32_t *)from;
+                                out += 4;
+                                from += 4;
+                            }
+                        }
                         while (out < pEnd) {
-                            *(uint32_t *)out = *(uint32_t *)from;
-                            out += 4;
-                            from += 4;
+                            *out++ = *from++;
                         }
-                        // correct for possible overshoot of destination ptr
-                        out = pEnd;
                     }
 #else
                         while (len > 2) {
@@ -267,14 +273,13 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
                     {
                         uint8_t *pEnd = out+len;
                         int overlap = (int)(intptr_t)(out-from);
+                        // PNGdec: pEnd can be the end of the output, so don't write past it
                         if (overlap > 4) { // overlap of source/dest won't impede normal copy
-                            while (out < pEnd) {
+                            while (out < pEnd-3) {
                                 *(uint32_t *)out = *(uint32_t *)from;
                                 out += 4;
                                 from += 4;
                             }
-                            // correct for possible overshoot of destination ptr
-                            out = pEnd;
                         } else if (overlap == 1 || overlap == 4) { // copy 1/4-byte patterns
                             uint32_t pattern;
                             if (overlap == 1) {
@@ -284,15 +289,14 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
                             } else {
                                 pattern = *(uint32_t *)from;
                             }
-                            while (out < pEnd) {
+                            while (out < pEnd-3) {
                                 *(uint32_t *)out = pattern;
                                 out += 4;
                             }
-                            out = pEnd; // correct possible overshoot
-                        } else { // overlap of 2 or 3
-                            while (out < pEnd) {
-                                *out++ = *from++;
-                            }
+                            from = out - overlap;
+                        }
+                        while (out < pEnd) { // tail end, or an overlap of 2 or 3
+                            *out++ = *from++;
                         }
                     }
 #else
@@ -367,4 +371,4 @@ void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
    - Moving len -= 3 statement into middle of loop
  */
 
-#endif /* !ASMINF */
+#endif /* !ASMINF && !PNG_FAST_INFLATE */
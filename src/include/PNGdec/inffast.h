@@ -9,3 +9,12 @@
  */
 
 void ZLIB_INTERNAL inflate_fast OF((z_streamp strm, unsigned start));
+
+/* PNGdec: input and output inflate() needs before it calls inflate_fast() */
+#if PNG_FAST_INFLATE
+#  define INFLATE_FAST_MIN_HAVE 16
+#  define INFLATE_FAST_MIN_LEFT 1
+#else
+#  define INFLATE_FAST_MIN_HAVE 6
+#  define INFLATE_FAST_MIN_LEFT 258
+#endif
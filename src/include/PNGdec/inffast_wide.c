@@ -0,0 +1,325 @@
+/* inffast_wide.c -- fast decoding a word at a time
+ * Copyright (C) 1995-2017 Mark Adler
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* PNGdec: the inflate_fast() built with PNG_FAST_INFLATE=1 instead of the one
+   in inffast.c.  It decodes the same stream with the same tables and state,
+   but refills the bit accumulator a whole (unaligned, little-endian) word at
+   a time, decodes runs of literals off one refill, copies matches a word at a
+   time, and runs with any amount of output space, so that inflate() uses it
+   for PNG rows shorter than the 258 bytes inffast.c needs. */
+
+#include "zutil.h"
+#include "inftrees.h"
+#include "inflate.h"
+#include "inffast.h"
+
+#if PNG_FAST_INFLATE && !defined(ASMINF)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+#  error "PNG_FAST_INFLATE needs a little-endian target"
+#endif
+
+typedef size_t bitbuf;          /* bit accumulator, as wide as a register */
+#define WORDBYTES ((unsigned)sizeof(bitbuf))
+#define WORDBITS (8 * WORDBYTES)
+
+local bitbuf loadword OF((z_const unsigned char FAR *p));
+local void storeword OF((unsigned char FAR *p, bitbuf w));
+
+local bitbuf loadword(p)
+z_const unsigned char FAR *p;
+{
+    bitbuf w;
+    zmemcpy(&w, p, sizeof(w));
+    return w;
+}
+
+local void storeword(p, w)
+unsigned char FAR *p;
+bitbuf w;
+{
+    zmemcpy(p, &w, sizeof(w));
+}
+
+/* Top the accumulator up to at least WORDBITS - 8 bits with one word load.
+   Bits above "bits" are either zero or the stream bits that belong there, so
+   or-ing in the next word at "bits" is safe either way. */
+#define REFILL() \
+    do { \
+        hold |= loadword(in) << bits; \
+        in += (WORDBITS - 1 - bits) >> 3; \
+        bits |= WORDBITS - 8; \
+    } while (0)
+
+/*
+   Decode literal, length, and distance codes and write out the resulting
+   literal and match bytes until either not enough input or output is
+   available, an end-of-block is encountered, or a data error is encountered.
+
+   Entry assumptions:
+
+        state->mode == LEN
+        strm->avail_in >= INFLATE_FAST_MIN_HAVE
+        strm->avail_out >= INFLATE_FAST_MIN_LEFT
+        start >= strm->avail_out
+        state->bits <= WORDBITS - 8
+
+   On return, state->mode is one of:
+
+        LEN -- ran out of enough input, out of output, or the next match
+               didn't fit in the output left (inflate() splits it)
+        TYPE -- reached end of block code, inflate() to interpret next block
+        BAD -- error in block data
+
+   Notes:
+
+    - A length/distance pair takes at most 48 bits.  With 64-bit words one
+      refill per symbol covers it; with 32-bit words it takes up to three.
+      Either way a symbol never reads more than 16 bytes past where it
+      starts, hence INFLATE_FAST_MIN_HAVE.
+
+    - Matches that end at least a word before the end of the output are
+      copied a word at a time, overwriting up to a word past their end.
+      Everything else is copied exactly, so the output buffer's size is
+      respected to the byte.
+ */
+void ZLIB_INTERNAL inflate_fast(z_streamp strm, unsigned start) {
+    struct inflate_state FAR *state;
+    z_const unsigned char FAR *in;      /* local strm->next_in */
+    z_const unsigned char FAR *first;   /* strm->next_in on entry */
+    z_const unsigned char FAR *last;    /* have enough input while in < last */
+    unsigned char FAR *out;     /* local strm->next_out */
+    unsigned char FAR *beg;     /* inflate()'s initial strm->next_out */
+    unsigned char FAR *end;     /* end of the output space */
+#ifdef INFLATE_STRICT
+    unsigned dmax;              /* maximum distance from zlib header */
+#endif
+    unsigned wsize;             /* window size or zero if not using window */
+    unsigned whave;             /* valid bytes in the window */
+    unsigned wnext;             /* window write index */
+    unsigned char FAR *window;  /* allocated sliding window, if wsize != 0 */
+    bitbuf hold;                /* local strm->hold */
+    unsigned bits;              /* local strm->bits */
+    z_const unsigned char FAR *symin;   /* in, hold and bits where the */
+    bitbuf symhold;                     /*  current symbol starts */
+    unsigned symbits;
+    code const FAR *lcode;      /* local strm->lencode */
+    code const FAR *dcode;      /* local strm->distcode */
+    unsigned lmask;             /* mask for first level of length codes */
+    unsigned dmask;             /* mask for first level of distance codes */
+    code here;                  /* retrieved table entry */
+    unsigned op;                /* code bits, operation, extra bits, or */
+                                /*  window position, window bytes to copy */
+    unsigned len;               /* match length, unused bytes */
+    unsigned dist;              /* match distance */
+    unsigned char FAR *from;    /* where to copy match from */
+    unsigned char FAR *stop;    /* where the match copy ends */
+    bitbuf pattern;             /* match bytes repeated across a word */
+
+    /* copy state to local variables */
+    state = (struct inflate_state FAR *)strm->state;
+    in = first = strm->next_in;
+    last = in + (strm->avail_in - (INFLATE_FAST_MIN_HAVE - 1));
+    out = strm->next_out;
+    beg = out - (start - strm->avail_out);
+    end = out + strm->avail_out;
+#ifdef INFLATE_STRICT
+    dmax = state->dmax;
+#endif
+    wsize = state->wsize;
+    whave = state->whave;
+    wnext = state->wnext;
+    window = state->window;
+    hold = (bitbuf)state->hold;
+    bits = state->bits;
+    lcode = state->lencode;
+    dcode = state->distcode;
+    lmask = (1U << state->lenbits) - 1;
+    dmask = (1U << state->distbits) - 1;
+
+    /* decode literals and length/distances until end-of-block or not enough
+       input data or output space */
+    do {
+        REFILL();
+        symin = in;
+        symhold = hold;
+        symbits = bits;
+        here = lcode[hold & lmask];
+      dolen:
+        op = (unsigned)(here.bits);
+        hold >>= op;
+        bits -= op;
+        op = (unsigned)(here.op);
+        if (op == 0) {                          /* literal */
+            Tracevv((stderr, here.val >= 0x20 && here.val < 0x7f ?
+                    "inflate:         literal '%c'\n" :
+                    "inflate:         literal 0x%02x\n", here.val));
+            *out++ = (unsigned char)(here.val);
+            /* more literals off the same refill, while they can't run out */
+            while (bits >= 15 && out < end) {
+                here = lcode[hold & lmask];
+                if (here.op != 0)
+                    break;
+                hold >>= here.bits;
+                bits -= here.bits;
+                *out++ = (unsigned char)(here.val);
+            }
+        }
+        else if (op & 16) {                     /* length base */
+            len = (unsigned)(here.val);
+            op &= 15;                           /* number of extra bits */
+            if (op) {
+                len += (unsigned)hold & ((1U << op) - 1);
+                hold >>= op;
+                bits -= op;
+            }
+            Tracevv((stderr, "inflate:         length %u\n", len));
+            if (WORDBITS < 64)
+                REFILL();
+            here = dcode[hold & dmask];
+          dodist:
+            op = (unsigned)(here.bits);
+            hold >>= op;
+            bits -= op;
+            op = (unsigned)(here.op);
+            if (op & 16) {                      /* distance base */
+                dist = (unsigned)(here.val);
+                op &= 15;                       /* number of extra bits */
+                if (WORDBITS < 64 && bits < op)
+                    REFILL();
+                dist += (unsigned)hold & ((1U << op) - 1);
+#ifdef INFLATE_STRICT
+                if (dist > dmax) {
+                    strm->msg = (char *)"invalid distance too far back";
+                    state->mode = BAD;
+                    break;
+                }
+#endif
+                hold >>= op;
+                bits -= op;
+                Tracevv((stderr, "inflate:         distance %u\n", dist));
+                if (len > (unsigned)(end - out)) {
+                    /* doesn't fit: give the symbol back for inflate() */
+                    in = symin;
+                    hold = symhold;
+                    bits = symbits;
+                    break;
+                }
+                op = (unsigned)(out - beg);     /* max distance in output */
+                if (dist > op) {                /* see if copy from window */
+                    op = dist - op;             /* distance back in window */
+                    if (op > whave) {
+                        if (state->sane) {
+                            strm->msg =
+                                (char *)"invalid distance too far back";
+                            state->mode = BAD;
+                            break;
+                        }
+                    }
+                    /* the window never overlaps the output being written */
+                    from = window;
+                    if (wnext == 0)             /* very common case */
+                        from += wsize - op;
+                    else if (wnext < op) {      /* wrap around window */
+                        from += wsize + wnext - op;
+                        op -= wnext;
+                        if (op < len) {         /* some from end of window */
+                            len -= op;
+                            zmemcpy(out, from, op);
+                            out += op;
+                            from = window;
+                            op = wnext;
+                        }
+                    }
+                    else                        /* contiguous in window */
+                        from += wnext - op;
+                    if (op > len)
+                        op = len;
+                    zmemcpy(out, from, op);
+                    out += op;
+                    len -= op;
+                    if (len == 0)
+                        continue;
+                }
+                from = out - dist;              /* rest from output */
+                if ((unsigned)(end - out) < len + WORDBYTES) {
+                    do {                        /* too near the end to overrun */
+                        *out++ = *from++;
+                    } while (--len);
+                }
+                else {
+                    stop = out + len;
+                    if (dist >= WORDBYTES) {    /* no overlap within a word */
+                        do {
+                            storeword(out, loadword(from));
+                            out += WORDBYTES;
+                            from += WORDBYTES;
+                        } while (out < stop);
+                    }
+                    else if (dist == 1) {       /* a run of one byte */
+                        pattern = (bitbuf)(*from) * ((bitbuf)-1 / 255);
+                        do {
+                            storeword(out, pattern);
+                            out += WORDBYTES;
+                        } while (out < stop);
+                    }
+                    else {
+                        /* only the first dist bytes of the word are the match
+                           so far, so step by dist and the rest gets
+                           overwritten by the next store */
+                        pattern = loadword(from);
+                        do {
+                            storeword(out, pattern);
+                            out += dist;
+                        } while (out < stop);
+                    }
+                    out = stop;
+                }
+            }
+            else if ((op & 64) == 0) {          /* 2nd level distance code */
+                here = dcode[here.val + (hold & ((1U << op) - 1))];
+                goto dodist;
+            }
+            else {
+                strm->msg = (char *)"invalid distance code";
+                state->mode = BAD;
+                break;
+            }
+        }
+        else if ((op & 64) == 0) {              /* 2nd level length code */
+            here = lcode[here.val + (hold & ((1U << op) - 1))];
+            goto dolen;
+        }
+        else if (op & 32) {                     /* end-of-block */
+            Tracevv((stderr, "inflate:         end of block\n"));
+            state->mode = TYPE;
+            break;
+        }
+        else {
+            strm->msg = (char *)"invalid literal/length code";
+            state->mode = BAD;
+            break;
+        }
+    } while (in < last && out < end);
+
+    /* return unused bytes, but none that came before this call's input */
+    len = bits >> 3;
+    if (len > (unsigned)(in - first))
+        len = (unsigned)(in - first);
+    in -= len;
+    bits -= len << 3;
+    hold &= ((bitbuf)1 << bits) - 1;
+
+    /* update state and return */
+    strm->next_in = in;
+    strm->next_out = out;
+    strm->avail_in -= (unsigned)(in - first);
+    strm->avail_out = (unsigned)(end - out);
+    state->hold = hold;
+    state->bits = bits;
+    return;
+}
+
+#endif /* PNG_FAST_INFLATE && !ASMINF */
@@ -98,6 +98,7 @@
 /* function prototypes */
 local int inflateStateCheck OF((z_streamp strm));
 local void fixedtables OF((struct inflate_state FAR *state));
+local void replayrecord OF((struct inflate_state FAR *state, unsigned long skip));
 local int updatewindow OF((z_streamp strm, const unsigned char FAR *end,
                            unsigned copy));
 #ifdef BUILDFIXED
@@ -141,6 +142,7 @@ z_streamp strm;
     state->lencode = state->distcode = state->next = state->codes;
     state->sane = 1;
     state->back = -1;
+    state->dynamic = 0;
     Tracev((stderr, "inflate: reset\n"));
     return Z_OK;
 }
@@ -234,6 +236,8 @@ int stream_size;
 //    Tracev((stderr, "inflate: allocated\n"));
 //    strm->state = (struct internal_state FAR *)state;
     state->strm = strm;
+    state->inplace = 0;
+    state->replay = Z_NULL;
 //    state->window = Z_NULL; <-- I set this too to avoid a later allocation
     state->mode = HEAD;     /* to pass state test in inflateReset2() */
     ret = inflateReset2(strm, windowBits);
@@ -327,6 +331,33 @@ struct inflate_state FAR *state;
     state->distbits = 5;
 }
 
+/*
+   PNGdec: add the tables just built for a dynamic block to state->replay, if
+   every block before it is there and there's room.  skip is how many bits its
+   header took after the block type.
+ */
+local void replayrecord(state, skip)
+struct inflate_state FAR *state;
+unsigned long skip;
+{
+    inflate_replay FAR *replay = state->replay;
+    unsigned used = (unsigned)(state->next - state->codes);
+
+    if (state->dynamic != replay->blocks || replay->blocks == REPLAY_BLOCKS ||
+            replay->used + used > REPLAY_CODES)
+        return;
+    zmemcpy(replay->codes + replay->used, state->codes, used * sizeof(code));
+    replay->block[replay->blocks].skip = skip;
+    replay->block[replay->blocks].lencode =
+        (unsigned short)(replay->used + (state->lencode - state->codes));
+    replay->block[replay->blocks].distcode =
+        (unsigned short)(replay->used + (state->distcode - state->codes));
+    replay->block[replay->blocks].lenbits = (unsigned char)state->lenbits;
+    replay->block[replay->blocks].distbits = (unsigned char)state->distbits;
+    replay->used += used;
+    replay->blocks++;
+}
+
 #ifdef MAKEFIXED
 #include <stdio.h>
 
@@ -412,6 +443,14 @@ unsigned copy;
 
     state = (struct inflate_state FAR *)strm->state;
 
+    /* PNGdec: all of the output is in one buffer that starts at window, so
+       there's nothing to copy; it just has more history now */
+    if (state->inplace) {
+        state->wnext += copy;
+        state->whave = state->wnext;
+        return 0;
+    }
+
     /* if it hasn't been done already, allocate space for the window */
 // DEBUG - I set up this buffer earlier to avoid using malloc
 //    if (state->window == Z_NULL) {
@@ -540,6 +579,10 @@ unsigned copy;
         bits -= (unsigned)(n); \
     } while (0)
 
+/* PNGdec: how many bits of input have been used so far */
+#define BITPOS() \
+    (((strm->total_in + (in - have)) << 3) - bits)
+
 /* Remove zero to seven bits as needed to go to a byte boundary */
 #define BYTEBITS() \
     do { \
@@ -702,7 +745,10 @@ int check_crc;
             len = BITS(4) + 8;
             if (state->wbits == 0)
                 state->wbits = len;
-            if (len > 15 || len > state->wbits) {
+            /* PNGdec: a window smaller than the stream's is allowed (small images never
+               look back that far); a match that does still fails with "invalid distance
+               too far back" */
+            if (len > 15) {
                 strm->msg = (char *)"invalid window size";
                 state->mode = BAD;
                 break;
@@ -931,6 +977,13 @@ int check_crc;
             state->mode = TYPE;
             break;
         case TABLE:
+            if (state->replay != Z_NULL &&
+                    state->dynamic < state->replay->blocks) {
+                state->mark = state->replay->block[state->dynamic].skip;
+                state->mode = REPLAY;
+                break;
+            }
+            state->mark = BITPOS();
             NEEDBITS(14);
             state->nlen = BITS(5) + 257;
             DROPBITS(5);
@@ -1050,18 +1103,47 @@ int check_crc;
                 break;
             }
             Tracev((stderr, "inflate:       codes ok\n"));
+            if (state->replay != Z_NULL)
+                replayrecord(state, BITPOS() - state->mark);
+            state->dynamic++;
+            state->mode = LEN_;
+            if (flush == Z_TREES) goto inf_leave;
+            break;
+        case REPLAY:
+            if (state->mark > bits) {   /* skip whole bytes without reading them */
+                state->mark -= bits;
+                INITBITS();
+                copy = (unsigned)(state->mark >> 3);
+                if (copy > have) copy = have;
+                have -= copy;
+                next += copy;
+                state->mark -= (unsigned long)copy << 3;
+            }
+            NEEDBITS(state->mark);
+            DROPBITS(state->mark);
+            state->lencode = state->replay->codes +
+                             state->replay->block[state->dynamic].lencode;
+            state->distcode = state->replay->codes +
+                              state->replay->block[state->dynamic].distcode;
+            state->lenbits = state->replay->block[state->dynamic].lenbits;
+            state->distbits = state->replay->block[state->dynamic].distbits;
+            Tracev((stderr, "inflate:       codes replayed\n"));
+            state->dynamic++;
             state->mode = LEN_;
             if (flush == Z_TREES) goto inf_leave;
         case LEN_:
             state->mode = LEN;
         case LEN:
-            if (have >= 6 && left >= 258) {
+            if (have >= INFLATE_FAST_MIN_HAVE && left >= INFLATE_FAST_MIN_LEFT) {
                 RESTORE();
                 inflate_fast(strm, out);
                 LOAD();
                 if (state->mode == TYPE)
                     state->back = -1;
-                break;
+                /* PNGdec: if it stopped short of a symbol that didn't fit,
+                   decode that one below rather than call it again */
+                if (state->mode != LEN)
+                    break;
             }
             state->back = 0;
             for (;;) {
@@ -1200,7 +1282,7 @@ int check_crc;
             {
                 uint8_t *pEnd = put+copy;
                 int overlap = (int)(intptr_t)(put-from);
-                if (overlap >= 4) { // overlap of source/dest won't impede normal copy
+                if ((uintptr_t)(put-from) >= 4) { // overlap of source/dest won't impede normal copy (PNGdec: unsigned, so a window that happens to sit after put counts too)
                     while (put < pEnd-3) { // overwriting the output buffer here would be bad, so respect the true length
                         *(uint32_t *)put = *(uint32_t *)from;
                         put += 4;
@@ -1213,11 +1295,13 @@ int check_crc;
                     uint32_t pattern = *from;
                     pattern = pattern | (pattern << 8);
                     pattern = pattern | (pattern << 16);
-                    while (put < pEnd) {
+                    while (put < pEnd-3) { // PNGdec: put can't go past the output buffer here either
                         *(uint32_t *)put = pattern;
                         put += 4;
                     }
-                    put = pEnd; // correct possible overshoot
+                    while (put < pEnd) {
+                        *put++ = (uint8_t)pattern;
+                    }
                 } else { // overlap of 2 or 3
                     while (put < pEnd) {
                         *put++ = *from++;
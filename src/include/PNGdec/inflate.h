@@ -37,6 +37,7 @@ typedef enum {
         TABLE,      /* i: waiting for dynamic block table lengths */
         LENLENS,    /* i: waiting for code length code lengths */
         CODELENS,   /* i: waiting for length/lit and distance code lengths */
+        REPLAY,     /* i: PNGdec: skipping a dynamic block header seen before */
             LEN_,       /* i: same as LEN below, but only first time in */
             LEN,        /* i: waiting for length/lit/eob code */
             LENEXT,     /* i: waiting for length extra bits */
@@ -68,6 +69,7 @@ typedef enum {
             TYPE -> TYPEDO -> STORED or TABLE or LEN_ or CHECK
             STORED -> COPY_ -> COPY -> TYPE
             TABLE -> LENLENS -> CODELENS -> LEN_
+            TABLE -> REPLAY -> LEN_
             LEN_ -> LEN
     Read deflate codes in fixed or dynamic block:
                 LEN -> LENEXT or LIT or TYPE
@@ -77,6 +79,36 @@ typedef enum {
         CHECK -> LENGTH -> DONE
  */
 
+/* PNGdec: build with PNG_FAST_INFLATE=1 for the inflate_fast() in
+   inffast_wide.c instead of the one in inffast.c */
+#ifndef PNG_FAST_INFLATE
+#define PNG_FAST_INFLATE 0
+#endif
+
+/* PNGdec: the code tables of a stream's first dynamic blocks, recorded while
+   inflating it so that inflating the same stream again can skip each block's
+   header instead of decoding it and building the tables again.  One block's
+   tables take around 700 codes, so raise REPLAY_CODES for streams flushed
+   into several dynamic blocks (blocks that don't fit are inflated as usual) */
+#ifndef REPLAY_BLOCKS
+#define REPLAY_BLOCKS 4
+#endif
+#ifndef REPLAY_CODES
+#define REPLAY_CODES 1024
+#endif
+typedef struct inflate_replay_s {
+    unsigned blocks;            /* blocks recorded so far */
+    unsigned used;              /* codes[] entries used by them */
+    struct {
+        unsigned long skip;     /* header bits after the 3-bit block type */
+        unsigned short lencode; /* where its tables start in codes[] */
+        unsigned short distcode;
+        unsigned char lenbits;
+        unsigned char distbits;
+    } block[REPLAY_BLOCKS];
+    code codes[REPLAY_CODES];
+} inflate_replay;
+
 /* State maintained between inflate() calls -- approximately 7K bytes, not
    including the allocated sliding window, which is up to 32K bytes. */
 struct inflate_state {
@@ -123,4 +155,9 @@ struct inflate_state {
     int sane;                   /* if false, allow invalid distance too far */
     int back;                   /* bits back of last unprocessed length/lit */
     unsigned was;               /* initial length of match */
+    int inplace;                /* PNGdec: window is the output buffer itself */
+    inflate_replay FAR *replay; /* PNGdec: tables to reuse and record, or Z_NULL */
+    unsigned dynamic;           /* PNGdec: dynamic blocks started so far */
+    unsigned long mark;         /* PNGdec: bit position of the block header, or
+                                   header bits left to skip */
 };
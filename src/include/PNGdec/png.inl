@@ -20,6 +20,9 @@
 //===========================================================================
 //
 #include "zlib.h"
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h> // ARMv7E-M packed SIMD intrinsics
+#endif
 //
 // Convert 8-bit grayscale into RGB565
 //
@@ -120,7 +123,7 @@ uint8_t *PNG_getPalette(PNGIMAGE *pPNG)
 
 int PNG_getBufferSize(PNGIMAGE *pPNG)
 {
-    return pPNG->iHeight * pPNG->iPitch;
+    return pPNG->iHeight * (pPNG->iPitch + 1);
 } /* PNG_getBufferSize() */
 
 uint8_t * PNG_getBuffer(PNGIMAGE *pPNG)
@@ -228,6 +231,160 @@ void s3_rgb565(uint8_t *pSrc, uint8_t *pDest, int iCount, bool bBigEndian);
 };
 #endif
 #endif
+static inline uint32_t PNGLoad32(const uint8_t *p)
+{
+    uint32_t u32;
+    memcpy(&u32, p, 4); // a single LDR on targets that allow unaligned access
+    return u32;
+}
+static inline void PNGStore32(uint8_t *p, uint32_t u32)
+{
+    memcpy(p, &u32, 4);
+}
+//
+// Packed line converters for the most common pixel types
+// They load/store whole 32-bit words instead of single bytes (little-endian
+// targets only). On by default for ARMv7E-M (Teensy 4.x, etc.); define
+// PNG_PACKED_CONVERT as 0 or 1 to override. The per-byte loops in PNGRGB565()
+// and PNGRGB888() are the portable fallback and produce identical output.
+//
+#ifndef PNG_PACKED_CONVERT
+#if defined(__ARM_FEATURE_SIMD32) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PNG_PACKED_CONVERT 1
+#else
+#define PNG_PACKED_CONVERT 0
+#endif
+#endif
+// R in bits 0-7, G in 8-15, B in 16-23 (a little-endian load of R,G,B,x) to RGB565
+static inline uint32_t PNGPack565(uint32_t u32)
+{
+    return ((u32 & 0xf8) << 8) | ((u32 & 0xfc00) >> 5) | ((u32 & 0xf80000) >> 19);
+}
+// byte swap both halves of a pair of RGB565 pixels
+static inline uint32_t PNGSwap565x2(uint32_t u32)
+{
+#if defined(__ARM_FEATURE_SIMD32)
+    return __rev16(u32);
+#else
+    return ((u32 >> 8) & 0x00ff00ff) | ((u32 << 8) & 0xff00ff00);
+#endif
+}
+static inline void PNGStore565x2(uint16_t *pDest, uint32_t u32Pixel0, uint32_t u32Pixel1, int bBigEndian)
+{
+    uint32_t u32 = PNGPack565(u32Pixel0) | (PNGPack565(u32Pixel1) << 16);
+    if (bBigEndian)
+        u32 = PNGSwap565x2(u32);
+    memcpy(pDest, &u32, 4);
+}
+//
+// RGBA (alpha ignored) -> RGB565, one pixel per word load, two pixels per store
+//
+static inline void PNGPackedRGBATo565(const uint8_t *s, uint16_t *pDest, int iCount, int bBigEndian)
+{
+    int x;
+    for (x=0; x+2<=iCount; x+=2) {
+        PNGStore565x2(pDest, PNGLoad32(s), PNGLoad32(s+4), bBigEndian);
+        pDest += 2;
+        s += 8;
+    }
+    if (x < iCount) {
+        uint16_t usPixel = (uint16_t)PNGPack565(PNGLoad32(s));
+        *pDest = bBigEndian ? __builtin_bswap16(usPixel) : usPixel;
+    }
+} /* PNGPackedRGBATo565() */
+//
+// RGB -> RGB565, 4 pixels from 3 word loads
+//
+static inline void PNGPackedRGBTo565(const uint8_t *s, uint16_t *pDest, int iCount, int bBigEndian)
+{
+    int x;
+    for (x=0; x+4<=iCount; x+=4) {
+        uint32_t w0 = PNGLoad32(s), w1 = PNGLoad32(s+4), w2 = PNGLoad32(s+8); // R0G0B0R1 G1B1R2G2 B2R3G3B3
+        PNGStore565x2(pDest, w0, (w0 >> 24) | (w1 << 8), bBigEndian);
+        PNGStore565x2(pDest+2, (w1 >> 16) | (w2 << 16), w2 >> 8, bBigEndian);
+        pDest += 4;
+        s += 12;
+    }
+    for (; x<iCount; x++) {
+        uint16_t usPixel = (uint16_t)PNGPack565(s[0] | (s[1] << 8) | (s[2] << 16));
+        *pDest++ = bBigEndian ? __builtin_bswap16(usPixel) : usPixel;
+        s += 3;
+    }
+} /* PNGPackedRGBTo565() */
+//
+// 8-bit indexed (no alpha) -> RGB565, 4 indices per word load
+// uses the RGB565 fast palette if there is one
+//
+static inline void PNGPackedIndexedTo565(const uint8_t *s, uint16_t *pDest, int iCount, const uint8_t *pPalette, const uint16_t *pFastPalette, int bBigEndian)
+{
+    int x, i;
+    for (x=0; x+4<=iCount; x+=4) {
+        uint32_t u32Indices = PNGLoad32(s), u32Pair[2];
+        for (i=0; i<2; i++) {
+            uint32_t c0 = u32Indices & 0xff, c1 = (u32Indices >> 8) & 0xff;
+            if (pFastPalette) {
+                u32Pair[i] = pFastPalette[c0] | (pFastPalette[c1] << 16);
+            } else {
+                const uint8_t *p0 = &pPalette[c0 * 3], *p1 = &pPalette[c1 * 3];
+                u32Pair[i] = PNGPack565(p0[0] | (p0[1] << 8) | (p0[2] << 16)) | (PNGPack565(p1[0] | (p1[1] << 8) | (p1[2] << 16)) << 16);
+            }
+            if (bBigEndian)
+                u32Pair[i] = PNGSwap565x2(u32Pair[i]);
+            u32Indices >>= 16;
+        }
+        memcpy(pDest, u32Pair, 8);
+        pDest += 4;
+        s += 4;
+    }
+    for (; x<iCount; x++) {
+        const uint8_t *p = &pPalette[*s * 3];
+        uint16_t usPixel = pFastPalette ? pFastPalette[*s] : (uint16_t)PNGPack565(p[0] | (p[1] << 8) | (p[2] << 16));
+        *pDest++ = bBigEndian ? __builtin_bswap16(usPixel) : usPixel;
+        s++;
+    }
+} /* PNGPackedIndexedTo565() */
+//
+// RGBA (alpha ignored) -> RGB888, 4 pixels from 4 word loads into 3 word stores
+//
+static inline void PNGPackedRGBATo888(const uint8_t *s, uint8_t *d, int iCount)
+{
+    int x;
+    for (x=0; x+4<=iCount; x+=4) {
+        uint32_t p0 = PNGLoad32(s), p1 = PNGLoad32(s+4), p2 = PNGLoad32(s+8), p3 = PNGLoad32(s+12);
+        PNGStore32(d,   (p0 & 0xffffff) | (p1 << 24));
+        PNGStore32(d+4, ((p1 >> 8) & 0xffff) | (p2 << 16));
+        PNGStore32(d+8, ((p2 >> 16) & 0xff) | (p3 << 8));
+        d += 12;
+        s += 16;
+    }
+    for (; x<iCount; x++) {
+        d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+        d += 3;
+        s += 4;
+    }
+} /* PNGPackedRGBATo888() */
+//
+// 8-bit indexed (no alpha) -> RGB888, 4 indices per word load, 3 word stores
+//
+static inline void PNGPackedIndexedTo888(const uint8_t *s, uint8_t *d, int iCount, const uint8_t *pPalette)
+{
+    int x;
+    for (x=0; x+4<=iCount; x+=4) {
+        uint32_t u32Indices = PNGLoad32(s);
+        const uint8_t *p0 = &pPalette[(u32Indices & 0xff) * 3], *p1 = &pPalette[((u32Indices >> 8) & 0xff) * 3];
+        const uint8_t *p2 = &pPalette[((u32Indices >> 16) & 0xff) * 3], *p3 = &pPalette[(u32Indices >> 24) * 3];
+        PNGStore32(d,   p0[0] | (p0[1] << 8) | (p0[2] << 16) | ((uint32_t)p1[0] << 24));
+        PNGStore32(d+4, p1[1] | (p1[2] << 8) | (p2[0] << 16) | ((uint32_t)p2[1] << 24));
+        PNGStore32(d+8, p2[2] | (p3[0] << 8) | (p3[1] << 16) | ((uint32_t)p3[2] << 24));
+        d += 12;
+        s += 4;
+    }
+    for (; x<iCount; x++) {
+        const uint8_t *p = &pPalette[*s++ * 3];
+        d[0] = p[0]; d[1] = p[1]; d[2] = p[2];
+        d += 3;
+    }
+} /* PNGPackedIndexedTo888() */
 //
 // Convert a line of native PNG pixels into RGB565
 // handles all standard pixel types
@@ -238,6 +395,8 @@ PNG_STATIC void PNGRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndiannes, uin
     int x, j;
     uint16_t usPixel, *pDest = pPixels;
     uint8_t c=0, a, *pPal, *s = pDraw->pPixels;
+
+    (void)iHasAlpha; // pDraw->iHasAlpha says the same thing
     
     switch (pDraw->iPixelType) {
         case PNG_PIXEL_GRAY_ALPHA:
@@ -281,6 +440,10 @@ PNG_STATIC void PNGRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndiannes, uin
             } // switch on bpp
             break;
         case PNG_PIXEL_TRUECOLOR:
+#if PNG_PACKED_CONVERT
+            PNGPackedRGBTo565(s, pDest, pDraw->iWidth, (iEndiannes == PNG_RGB565_BIG_ENDIAN));
+            break;
+#endif
             for (x=0; x<pDraw->iWidth; x++) {
                 usPixel = (s[2] >> 3); // blue
                 usPixel |= ((s[1] >> 2) << 5); // green
@@ -292,6 +455,12 @@ PNG_STATIC void PNGRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndiannes, uin
             }
             break;
         case PNG_PIXEL_INDEXED: // palette color (can be 1/2/4 or 8 bits per pixel)
+#if PNG_PACKED_CONVERT
+            if (pDraw->iBpp == 8 && !pDraw->iHasAlpha) {
+                PNGPackedIndexedTo565(s, pDest, pDraw->iWidth, pDraw->pPalette, pDraw->pFastPalette, (iEndiannes == PNG_RGB565_BIG_ENDIAN));
+                return;
+            }
+#endif
             if (pDraw->pFastPalette && !pDraw->iHasAlpha) { // faster RGB565 palette exists
                switch (pDraw->iBpp) {
                    case 8:
@@ -455,6 +624,8 @@ PNG_STATIC void PNGRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndiannes, uin
             } else { // ignore alpha
 #ifdef ARDUINO_ESP32S3_DEV
                 s3_rgb565(s, (uint8_t *)pDest, pDraw->iWidth, (iEndiannes == PNG_RGB565_BIG_ENDIAN));
+#elif PNG_PACKED_CONVERT
+                PNGPackedRGBATo565(s, pDest, pDraw->iWidth, (iEndiannes == PNG_RGB565_BIG_ENDIAN));
 #else
                 for (x=0; x<pDraw->iWidth; x++) {
                     usPixel = (s[2] >> 3); // blue
@@ -471,6 +642,288 @@ PNG_STATIC void PNGRGB565(PNGDRAW *pDraw, uint16_t *pPixels, int iEndiannes, uin
     }
 } /* PNGRGB565() */
 //
+// Write one RGB888 pixel, mixing it with the background color by its alpha
+// unless the background is 0xffffffff (ignore alpha)
+//
+static inline uint8_t * PNGPut888(uint8_t *d, uint32_t r, uint32_t g, uint32_t b, uint32_t a, uint32_t u32Bkgd)
+{
+    if (a != 255 && u32Bkgd != 0xffffffff) {
+        if (a == 0) {
+            r = u32Bkgd & 0xff; g = (u32Bkgd >> 8) & 0xff; b = (u32Bkgd >> 16) & 0xff;
+        } else { // mix the colors
+            r = ((r * a) + ((u32Bkgd & 0xff) * (255-a))) >> 8;
+            g = ((g * a) + (((u32Bkgd >> 8) & 0xff) * (255-a))) >> 8;
+            b = ((b * a) + (((u32Bkgd >> 16) & 0xff) * (255-a))) >> 8;
+        }
+    }
+    d[0] = (uint8_t)r; d[1] = (uint8_t)g; d[2] = (uint8_t)b;
+    return d + 3;
+} /* PNGPut888() */
+//
+// Convert a line of native PNG pixels into RGB888 (3 bytes per pixel, R,G,B order)
+// handles all standard pixel types at full precision
+// Background color is in the form of a uint32_t -> 00BBGGRR (MSB on left)
+// 0xffffffff ignores alpha, 0 gives premultiplied alpha
+//
+PNG_STATIC void PNGRGB888(PNGDRAW *pDraw, uint8_t *pPixels, uint32_t u32Bkgd, int iHasAlpha)
+{
+    int x, iShift, iMask;
+    uint32_t a = 255;
+    uint8_t c=0, ucScale, *pPal, *d = pPixels, *s = pDraw->pPixels;
+
+    switch (pDraw->iPixelType) {
+        case PNG_PIXEL_GRAY_ALPHA:
+            for (x=0; x<pDraw->iWidth; x++) {
+                c = s[0];
+                d = PNGPut888(d, c, c, c, s[1], u32Bkgd);
+                s += 2;
+            }
+            break;
+        case PNG_PIXEL_GRAYSCALE:
+            if (pDraw->iBpp == 8) {
+                for (x=0; x<pDraw->iWidth; x++) {
+                    c = *s++;
+                    d[0] = d[1] = d[2] = c;
+                    d += 3;
+                }
+                break;
+            }
+            // 1/2/4-bit gray levels get stretched to the full 0-255 range
+            iShift = 8 - pDraw->iBpp;
+            ucScale = 255 / ((1 << pDraw->iBpp) - 1);
+            for (x=0; x<pDraw->iWidth; x++) {
+                if ((x & ((8 / pDraw->iBpp) - 1)) == 0) {
+                    c = *s++;
+                }
+                d[0] = d[1] = d[2] = (uint8_t)((c >> iShift) * ucScale);
+                d += 3;
+                c <<= pDraw->iBpp;
+            }
+            break;
+        case PNG_PIXEL_TRUECOLOR:
+            memcpy(d, s, pDraw->iWidth * 3);
+            break;
+        case PNG_PIXEL_INDEXED: // palette color (can be 1/2/4 or 8 bits per pixel)
+#if PNG_PACKED_CONVERT
+            if (pDraw->iBpp == 8 && !iHasAlpha) {
+                PNGPackedIndexedTo888(s, d, pDraw->iWidth, pDraw->pPalette);
+                break;
+            }
+#endif
+            iShift = 8 - pDraw->iBpp;
+            iMask = 8 / pDraw->iBpp - 1;
+            for (x=0; x<pDraw->iWidth; x++) {
+                int i;
+                if (pDraw->iBpp == 8) {
+                    i = *s++;
+                } else {
+                    if ((x & iMask) == 0) {
+                        c = *s++;
+                    }
+                    i = c >> iShift;
+                    c <<= pDraw->iBpp;
+                }
+                pPal = &pDraw->pPalette[i * 3];
+                if (iHasAlpha)
+                    a = pDraw->pPalette[768 + i];
+                d = PNGPut888(d, pPal[0], pPal[1], pPal[2], a, u32Bkgd);
+            }
+            break;
+        case PNG_PIXEL_TRUECOLOR_ALPHA: // truecolor + alpha
+            if (u32Bkgd != 0xffffffff) { // user wants to blend it with a background color
+                for (x=0; x<pDraw->iWidth; x++) {
+                    d = PNGPut888(d, s[0], s[1], s[2], s[3], u32Bkgd);
+                    s += 4;
+                }
+            } else { // ignore alpha
+#if PNG_PACKED_CONVERT
+                PNGPackedRGBATo888(s, d, pDraw->iWidth);
+                break;
+#endif
+                for (x=0; x<pDraw->iWidth; x++) {
+                    d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+                    d += 3;
+                    s += 4; // skip alpha
+                }
+            }
+            break;
+    }
+} /* PNGRGB888() */
+//
+// Convert a line to RGB888 and build its alpha mask in the same pass
+// The mask has the same layout as PNGMakeMask() (1 bit per pixel, MSB = leftmost,
+// set = alpha >= ucThreshold); bits past the line's width are 0
+// returns PNG_MASK_ANY_OPAQUE and/or PNG_MASK_ALL_OPAQUE
+//
+#define PNG_MASK_PUT(a) \
+    ucBits = (uint8_t)((ucBits << 1) | ((a) >= ucThreshold)); \
+    if ((x & 7) == 7) { \
+        *pMask++ = ucBits; ucAny |= ucBits; ucAll &= ucBits; ucBits = 0; \
+    }
+PNG_STATIC uint8_t PNGRGB888Mask(PNGDRAW *pDraw, uint8_t *pPixels, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd)
+{
+    int x, i, iShift, iMask;
+    uint32_t a = 255;
+    uint8_t c = 0, ucBits = 0, ucAny = 0, ucAll = 0xff, *pPal, *d = pPixels, *s = pDraw->pPixels;
+
+    switch (pDraw->iPixelType) {
+        case PNG_PIXEL_TRUECOLOR_ALPHA:
+            for (x=0; x<pDraw->iWidth; x++) {
+                a = s[3];
+                d = PNGPut888(d, s[0], s[1], s[2], a, u32Bkgd);
+                PNG_MASK_PUT(a)
+                s += 4;
+            }
+            break;
+        case PNG_PIXEL_GRAY_ALPHA:
+            for (x=0; x<pDraw->iWidth; x++) {
+                a = s[1];
+                d = PNGPut888(d, s[0], s[0], s[0], a, u32Bkgd);
+                PNG_MASK_PUT(a)
+                s += 2;
+            }
+            break;
+        case PNG_PIXEL_INDEXED: // palette alpha is all 0xff unless there was a tRNS chunk
+            iShift = 8 - pDraw->iBpp;
+            iMask = 8 / pDraw->iBpp - 1;
+            for (x=0; x<pDraw->iWidth; x++) {
+                if (pDraw->iBpp == 8) {
+                    i = *s++;
+                } else {
+                    if ((x & iMask) == 0) {
+                        c = *s++;
+                    }
+                    i = c >> iShift;
+                    c <<= pDraw->iBpp;
+                }
+                pPal = &pDraw->pPalette[i * 3];
+                a = pDraw->pPalette[768 + i];
+                d = PNGPut888(d, pPal[0], pPal[1], pPal[2], (pDraw->iHasAlpha) ? a : 255, u32Bkgd);
+                PNG_MASK_PUT(a)
+            }
+            break;
+        default: // No alpha channel; make a mask of all 1's
+            PNGRGB888(pDraw, pPixels, u32Bkgd, pDraw->iHasAlpha);
+            memset(pMask, 0xff, pDraw->iWidth >> 3);
+            if (pDraw->iWidth & 7)
+                pMask[pDraw->iWidth >> 3] = (uint8_t)(0xff << (8 - (pDraw->iWidth & 7)));
+            return PNG_MASK_ANY_OPAQUE | PNG_MASK_ALL_OPAQUE;
+    }
+    if (x & 7) { // partial last byte
+        ucBits <<= (8 - (x & 7));
+        *pMask = ucBits;
+        ucAny |= ucBits;
+        ucAll &= ucBits | (0xff >> (x & 7));
+    }
+    return (ucAny ? PNG_MASK_ANY_OPAQUE : 0) | ((ucAll == 0xff) ? PNG_MASK_ALL_OPAQUE : 0);
+} /* PNGRGB888Mask() */
+#undef PNG_MASK_PUT
+//
+// Unpack a line of an indexed image to one palette index per byte
+// returns the number of palette entries the bit depth can address,
+// or 0 if the image isn't indexed
+//
+PNG_STATIC int PNGIndexes(PNGDRAW *pDraw, uint8_t *pIndexes)
+{
+    int x, iShift;
+    uint8_t c = 0, *s = pDraw->pPixels;
+
+    if (pDraw->iPixelType != PNG_PIXEL_INDEXED)
+        return 0;
+    if (pDraw->iBpp == 8) {
+        memcpy(pIndexes, s, pDraw->iWidth);
+        return 256;
+    }
+    iShift = 8 - pDraw->iBpp;
+    for (x=0; x<pDraw->iWidth; x++) {
+        if ((x & (8 / pDraw->iBpp - 1)) == 0) {
+            c = *s++;
+        }
+        *pIndexes++ = (uint8_t)(c >> iShift);
+        c <<= pDraw->iBpp;
+    }
+    return 1 << pDraw->iBpp;
+} /* PNGIndexes() */
+//
+// Write one alpha byte per pixel, 255 for pixel types without alpha
+// (tRNS color keys aren't applied, same as PNGRGB888Mask())
+// returns 1 if every pixel is fully opaque
+//
+PNG_STATIC int PNGAlpha(PNGDRAW *pDraw, uint8_t *pAlpha)
+{
+    int x, i, iShift, iMask;
+    uint8_t a, c = 0, ucAll = 0xff, *s = pDraw->pPixels;
+
+    switch (pDraw->iPixelType) {
+        case PNG_PIXEL_TRUECOLOR_ALPHA:
+            for (x=0; x<pDraw->iWidth; x++) {
+                a = s[3];
+                *pAlpha++ = a;
+                ucAll &= a;
+                s += 4;
+            }
+            break;
+        case PNG_PIXEL_GRAY_ALPHA:
+            for (x=0; x<pDraw->iWidth; x++) {
+                a = s[1];
+                *pAlpha++ = a;
+                ucAll &= a;
+                s += 2;
+            }
+            break;
+        case PNG_PIXEL_INDEXED:
+            if (pDraw->iHasAlpha) {
+                iShift = 8 - pDraw->iBpp;
+                iMask = 8 / pDraw->iBpp - 1;
+                for (x=0; x<pDraw->iWidth; x++) {
+                    if (pDraw->iBpp == 8) {
+                        i = *s++;
+                    } else {
+                        if ((x & iMask) == 0) {
+                            c = *s++;
+                        }
+                        i = c >> iShift;
+                        c <<= pDraw->iBpp;
+                    }
+                    a = pDraw->pPalette[768 + i];
+                    *pAlpha++ = a;
+                    ucAll &= a;
+                }
+                break;
+            }
+            // fall through - no tRNS, so it's opaque
+        default:
+            memset(pAlpha, 0xff, pDraw->iWidth);
+            break;
+    }
+    return (ucAll == 0xff);
+} /* PNGAlpha() */
+//
+// Convert the palette itself to RGB888 + alpha mask, exactly as PNGRGB888Mask()
+// would convert each entry in a line, so index lookups into it match a line conversion
+// pPalette needs room for 256 entries (768 bytes), pMask for 32 bytes
+// returns the number of entries the bit depth can address, or 0 if the image isn't indexed
+//
+PNG_STATIC int PNGPalette888Mask(PNGDRAW *pDraw, uint8_t *pPalette, uint8_t *pMask, uint8_t ucThreshold, uint32_t u32Bkgd)
+{
+    PNGDRAW pd;
+    uint8_t ucIndexes[256];
+    int i, iCount;
+
+    if (pDraw->iPixelType != PNG_PIXEL_INDEXED)
+        return 0;
+    iCount = 1 << pDraw->iBpp;
+    for (i=0; i<iCount; i++)
+        ucIndexes[i] = (uint8_t)i;
+    pd = *pDraw; // treat the palette as one 8-bpp line of every index
+    pd.iBpp = 8;
+    pd.iWidth = iCount;
+    pd.iPitch = iCount;
+    pd.pPixels = ucIndexes;
+    PNGRGB888Mask(&pd, pPalette, pMask, ucThreshold, u32Bkgd);
+    return iCount;
+} /* PNGPalette888Mask() */
+//
 // Helper functions for memory based images
 //
 PNG_STATIC int32_t seekMem(PNGFILE *pFile, int32_t iPosition)
@@ -557,106 +1010,323 @@ PNG_STATIC int PNGParseInfo(PNGIMAGE *pPage)
                 pPage->iHasAlpha = 1;
         } // switch
     }
-    if (pPage->iPitch >= PNG_MAX_BUFFERED_PIXELS)
-       return PNG_TOO_BIG;
+    if (pPage->iWidth > pPage->iMaxWidth || pPage->iPitch > pPage->iMaxPitch)
+       return PNG_TOO_BIG; // a wide low-bpp image fits iMaxPitch but overruns per-pixel line buffers
 
     return PNG_SUCCESS;
 } /* PNGParseInfo() */
 //
-// De-filter the current line of pixels
+// Packed 4 x 8-bit helpers for the DeFilter kernels
+// ARMv7E-M (Cortex-M4/M7) does each of these in one instruction (UADD8/UHADD8)
+// everywhere else they're done SWAR style in a 32-bit register
 //
-PNG_STATIC void DeFilter(uint8_t *pCurr, uint8_t *pPrev, int iWidth, int iPitch)
+#if defined(__ARM_FEATURE_SIMD32)
+static inline uint32_t PNGUAdd8(uint32_t a, uint32_t b) { return __uadd8(a, b); }
+static inline uint32_t PNGUHAdd8(uint32_t a, uint32_t b) { return __uhadd8(a, b); }
+#else
+static inline uint32_t PNGUAdd8(uint32_t a, uint32_t b)
 {
-    uint8_t ucFilter = *pCurr++;
-    int x, iBpp;
-    if (iPitch <= iWidth)
-        iBpp = 1;
-    else
-        iBpp = iPitch / iWidth;
-    
-    pPrev++; // skip filter of previous line
-    switch (ucFilter) { // switch on filter type
-        case PNG_FILTER_NONE:
-            // nothing to do :)
-            break;
-        case PNG_FILTER_SUB:
-            for (x=iBpp; x<iPitch; x++) {
-                pCurr[x] += pCurr[x-iBpp];
-            }
-            break;
-        case PNG_FILTER_UP:
-            for (x = 0; x < iPitch; x++) {
-               pCurr[x] += pPrev[x];
-            }
-            break;
-        case PNG_FILTER_AVG:
-            for (x = 0; x < iBpp; x++) {
-               pCurr[x] = (pCurr[x] +
-                  pPrev[x] / 2 );
-            }
-            for (x = iBpp; x < iPitch; x++) {
-               pCurr[x] = pCurr[x] +
-                  (pPrev[x] + pCurr[x-iBpp]) / 2;
-            }
-            break;
-        case PNG_FILTER_PAETH:
-            if (iBpp == 1) {
-                int a, c;
-                uint8_t *pEnd = &pCurr[iPitch];
-                // First pixel/byte
-                c = *pPrev++;
-                a = *pCurr + c;
-                *pCurr++ = (uint8_t)a;
-                while (pCurr < pEnd) {
-                   int b, pa, pb, pc, p;
-                   a &= 0xff; // From previous iteration
-                   b = *pPrev++;
-                   p = b - c;
-                   pc = a - c;
-                   // assume no native ABS() instruction
-                   pa = p < 0 ? -p : p;
-                   pb = pc < 0 ? -pc : pc;
-                   pc = (p + pc) < 0 ? -(p + pc) : p + pc;
-                   // choose the best predictor
-                   if (pb < pa) {
-                      pa = pb; a = b;
-                   }
-                   if (pc < pa) a = c;
-                   // Calculate current pixel
-                   c = b;
-                   a += *pCurr;
-                   *pCurr++ = (uint8_t)a;
-                }
-            } else { // multi-byte
-                uint8_t *pEnd = &pCurr[iBpp];
-                // first pixel is treated the same as 'up'
-                while (pCurr < pEnd) {
-                   int a = *pCurr + *pPrev++;
-                   *pCurr++ = (uint8_t)a;
-                }
-                pEnd = pEnd + (iPitch - iBpp);
-                while (pCurr < pEnd) {
-                   int a, b, c, pa, pb, pc, p;
-                   c = pPrev[-iBpp];
-                   a = pCurr[-iBpp];
-                   b = *pPrev++;
-                   p = b - c;
-                   pc = a - c;
-                    // assume no native ABS() instruction
-                   pa = p < 0 ? -p : p;
-                   pb = pc < 0 ? -pc : pc;
-                   pc = (p + pc) < 0 ? -(p + pc) : p + pc;
-                   if (pb < pa) {
-                      pa = pb; a = b;
-                   }
-                   if (pc < pa) a = c;
-                   a += *pCurr;
-                   *pCurr++ = (uint8_t)a;
-                }
-            } // multi-byte
-            break;
-    } // switch on filter type
-} /* DeFilter() */
+    return ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080); // no carries between lanes
+}
+static inline uint32_t PNGUHAdd8(uint32_t a, uint32_t b)
+{
+    return (a & b) + (((a ^ b) >> 1) & 0x7f7f7f7f); // (a+b)/2 per lane without overflow
+}
+#endif
+static inline uint8_t PNGPaeth(int a, int b, int c)
+{
+    int pa, pb, pc, p;
+    p = b - c;
+    pc = a - c;
+    // assume no native ABS() instruction
+    pa = p < 0 ? -p : p;
+    pb = pc < 0 ? -pc : pc;
+    pc = (p + pc) < 0 ? -(p + pc) : p + pc;
+    // choose the best predictor
+    if (pb < pa) {
+        pa = pb; a = b;
+    }
+    if (pc < pa) a = c;
+    return (uint8_t)a;
+} /* PNGPaeth() */
+//
+// De-filter kernels
+// pCurr/pPrev point past the filter byte; one kernel per filter type, with
+// specialized versions for the common 1, 3 and 4 byte pixels
+//
+typedef void (PNG_DEFILTER_FUNC)(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp);
+
+static void DeFilterNone(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    (void)pCurr; (void)pPrev; (void)iPitch; (void)iBpp;
+    // nothing to do :)
+} /* DeFilterNone() */
+
+static void DeFilterSub(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    (void)pPrev;
+    for (x=iBpp; x<iPitch; x++) {
+        pCurr[x] += pCurr[x-iBpp];
+    }
+} /* DeFilterSub() */
+
+static void DeFilterUp(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    (void)iBpp;
+    for (x = 0; x < iPitch; x++) {
+       pCurr[x] += pPrev[x];
+    }
+} /* DeFilterUp() */
+
+static void DeFilterAvg(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    for (x = 0; x < iBpp; x++) {
+       pCurr[x] = (pCurr[x] +
+          pPrev[x] / 2 );
+    }
+    for (x = iBpp; x < iPitch; x++) {
+       pCurr[x] = pCurr[x] +
+          (pPrev[x] + pCurr[x-iBpp]) / 2;
+    }
+} /* DeFilterAvg() */
+
+static void DeFilterPaeth(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    if (iBpp == 1) {
+        int a, c;
+        uint8_t *pEnd = &pCurr[iPitch];
+        // First pixel/byte
+        c = *pPrev++;
+        a = *pCurr + c;
+        *pCurr++ = (uint8_t)a;
+        while (pCurr < pEnd) {
+           int b;
+           a &= 0xff; // From previous iteration
+           b = *pPrev++;
+           a = PNGPaeth(a, b, c);
+           // Calculate current pixel
+           c = b;
+           a += *pCurr;
+           *pCurr++ = (uint8_t)a;
+        }
+    } else { // multi-byte
+        uint8_t *pEnd = &pCurr[iBpp];
+        // first pixel is treated the same as 'up'
+        while (pCurr < pEnd) {
+           int a = *pCurr + *pPrev++;
+           *pCurr++ = (uint8_t)a;
+        }
+        pEnd = pEnd + (iPitch - iBpp);
+        while (pCurr < pEnd) {
+           int a = PNGPaeth(pCurr[-iBpp], *pPrev, pPrev[-iBpp]);
+           pPrev++;
+           a += *pCurr;
+           *pCurr++ = (uint8_t)a;
+        }
+    } // multi-byte
+} /* DeFilterPaeth() */
+//
+// 'up' doesn't depend on neighbouring pixels, so any pixel size can go 4 bytes at a time
+//
+static void DeFilterUp32(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    (void)iBpp;
+    for (x = 0; x + 4 <= iPitch; x += 4) {
+        PNGStore32(&pCurr[x], PNGUAdd8(PNGLoad32(&pCurr[x]), PNGLoad32(&pPrev[x])));
+    }
+    for (; x < iPitch; x++) {
+        pCurr[x] += pPrev[x];
+    }
+} /* DeFilterUp32() */
+//
+// 4-byte pixels (RGBA) are exactly one 32-bit word, so each pixel is one packed op
+//
+static void DeFilterSub4(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    uint32_t u32Left = PNGLoad32(pCurr);
+    (void)pPrev; (void)iBpp;
+    for (x = 4; x < iPitch; x += 4) {
+        u32Left = PNGUAdd8(PNGLoad32(&pCurr[x]), u32Left);
+        PNGStore32(&pCurr[x], u32Left);
+    }
+} /* DeFilterSub4() */
+
+static void DeFilterAvg4(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    uint32_t u32Left = 0;
+    (void)iBpp;
+    for (x = 0; x < iPitch; x += 4) {
+        u32Left = PNGUAdd8(PNGLoad32(&pCurr[x]), PNGUHAdd8(PNGLoad32(&pPrev[x]), u32Left));
+        PNGStore32(&pCurr[x], u32Left);
+    }
+} /* DeFilterAvg4() */
+
+static void DeFilterPaeth4(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    (void)iBpp;
+    // first pixel is treated the same as 'up'
+    PNGStore32(pCurr, PNGUAdd8(PNGLoad32(pCurr), PNGLoad32(pPrev)));
+    // Paeth's predictor needs 9-bit intermediates, so the 4 lanes are unrolled instead of packed
+    for (x = 4; x < iPitch; x += 4) {
+        pCurr[x]   += PNGPaeth(pCurr[x-4], pPrev[x],   pPrev[x-4]);
+        pCurr[x+1] += PNGPaeth(pCurr[x-3], pPrev[x+1], pPrev[x-3]);
+        pCurr[x+2] += PNGPaeth(pCurr[x-2], pPrev[x+2], pPrev[x-2]);
+        pCurr[x+3] += PNGPaeth(pCurr[x-1], pPrev[x+3], pPrev[x-1]);
+    }
+} /* DeFilterPaeth4() */
+//
+// 3-byte pixels (RGB) straddle words, so these are unrolled per pixel
+//
+static void DeFilterSub3(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    uint8_t r = pCurr[0], g = pCurr[1], b = pCurr[2];
+    (void)pPrev; (void)iBpp;
+    for (x = 3; x < iPitch; x += 3) {
+        pCurr[x]   = r = (uint8_t)(pCurr[x] + r);
+        pCurr[x+1] = g = (uint8_t)(pCurr[x+1] + g);
+        pCurr[x+2] = b = (uint8_t)(pCurr[x+2] + b);
+    }
+} /* DeFilterSub3() */
+
+static void DeFilterAvg3(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    uint8_t r = 0, g = 0, b = 0;
+    (void)iBpp;
+    for (x = 0; x < iPitch; x += 3) {
+        pCurr[x]   = r = (uint8_t)(pCurr[x] + ((pPrev[x] + r) >> 1));
+        pCurr[x+1] = g = (uint8_t)(pCurr[x+1] + ((pPrev[x+1] + g) >> 1));
+        pCurr[x+2] = b = (uint8_t)(pCurr[x+2] + ((pPrev[x+2] + b) >> 1));
+    }
+} /* DeFilterAvg3() */
+
+static void DeFilterPaeth3(uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    int x;
+    (void)iBpp;
+    // first pixel is treated the same as 'up'
+    pCurr[0] += pPrev[0]; pCurr[1] += pPrev[1]; pCurr[2] += pPrev[2];
+    for (x = 3; x < iPitch; x += 3) {
+        pCurr[x]   += PNGPaeth(pCurr[x-3], pPrev[x],   pPrev[x-3]);
+        pCurr[x+1] += PNGPaeth(pCurr[x-2], pPrev[x+1], pPrev[x-2]);
+        pCurr[x+2] += PNGPaeth(pCurr[x-1], pPrev[x+2], pPrev[x-1]);
+    }
+} /* DeFilterPaeth3() */
+
+// indexed by filter type; the scalar set is the plain byte-at-a-time reference the others are checked against
+static PNG_DEFILTER_FUNC * const pfnDeFilterScalar[PNG_FILTER_COUNT] = {DeFilterNone, DeFilterSub, DeFilterUp, DeFilterAvg, DeFilterPaeth};
+static PNG_DEFILTER_FUNC * const pfnDeFilterAny[PNG_FILTER_COUNT] = {DeFilterNone, DeFilterSub, DeFilterUp32, DeFilterAvg, DeFilterPaeth};
+static PNG_DEFILTER_FUNC * const pfnDeFilter3[PNG_FILTER_COUNT] = {DeFilterNone, DeFilterSub3, DeFilterUp32, DeFilterAvg3, DeFilterPaeth3};
+static PNG_DEFILTER_FUNC * const pfnDeFilter4[PNG_FILTER_COUNT] = {DeFilterNone, DeFilterSub4, DeFilterUp32, DeFilterAvg4, DeFilterPaeth4};
+//
+// Bytes per pixel as the filters see it (sub-byte pixels count as 1)
+//
+static inline int PNGFilterBpp(int iWidth, int iPitch)
+{
+    return (iPitch <= iWidth) ? 1 : iPitch / iWidth;
+} /* PNGFilterBpp() */
+//
+// Pick the fastest set of de-filter kernels for this pixel size
+// called once per image rather than once per line
+//
+PNG_STATIC PNG_DEFILTER_FUNC * const * PNGDeFilterKernels(int iWidth, int iPitch)
+{
+    switch (PNGFilterBpp(iWidth, iPitch)) {
+        case 3:
+            return pfnDeFilter3;
+        case 4:
+            return pfnDeFilter4;
+        default:
+            return pfnDeFilterAny;
+    }
+} /* PNGDeFilterKernels() */
+//
+// De-filter the current line of pixels with the kernels picked by PNGDeFilterKernels()
+// (or with pfnDeFilterScalar as the reference); iBpp comes from PNGFilterBpp()
+//
+static inline void DeFilterLine(PNG_DEFILTER_FUNC * const *pfnKernels, uint8_t *pCurr, uint8_t *pPrev, int iPitch, int iBpp)
+{
+    uint8_t ucFilter = *pCurr;
+    if (ucFilter < PNG_FILTER_COUNT)
+        (*pfnKernels[ucFilter])(pCurr+1, pPrev+1, iPitch, iBpp); // skip filter bytes
+} /* DeFilterLine() */
+//
+// De-filter a frame buffer decode in place
+// The lines were inflated with their filter bytes (they're the LZ77 history, so
+// they can't change until the whole image is out); each line is de-filtered
+// against the one above it and then packed down to y * iPitch
+//
+static void DeFilterFrame(PNGIMAGE *pPage, PNG_DEFILTER_FUNC * const *pfnKernels, int iBpp, uint8_t *pZeros)
+{
+    int y;
+    uint8_t *pLine, *pAbove = pZeros; // the line above the first one is all 0's
+    for (y=0; y<pPage->iHeight; y++) {
+        pLine = &pPage->pImage[y * (pPage->iPitch + 1)];
+        if (pLine[0] < PNG_FILTER_COUNT)
+            (*pfnKernels[pLine[0]])(&pLine[1], pAbove, pPage->iPitch, iBpp);
+        memmove(&pPage->pImage[y * pPage->iPitch], &pLine[1], pPage->iPitch); // never reaches the next line's filter byte
+        pAbove = &pPage->pImage[y * pPage->iPitch];
+    }
+} /* DeFilterFrame() */
+//
+// Read the CRC at the end of the chunk whose data starts at s[iOffset]
+// If it isn't in the file buffer, read it from the file and seek back
+// returns 0 if it couldn't be read
+//
+static int PNGChunkCRC(PNGIMAGE *pPage, uint8_t *s, int iOffset, int iLen, int iBytesRead, int iFileOffset, uint32_t *pCRC)
+{
+    uint8_t ucCRC[4];
+    if (iOffset + iLen + 4 <= iBytesRead) {
+        *pCRC = MOTOLONG(&s[iOffset + iLen]);
+        return 1;
+    }
+    (*pPage->pfnSeek)(&pPage->PNGFile, iFileOffset - iBytesRead + iOffset + iLen);
+    iLen = (*pPage->pfnRead)(&pPage->PNGFile, ucCRC, 4);
+    (*pPage->pfnSeek)(&pPage->PNGFile, iFileOffset);
+    *pCRC = MOTOLONG(ucCRC);
+    return (iLen == 4);
+} /* PNGChunkCRC() */
+//
+// Find the Huffman tables recorded for this image, or an entry to record them in
+// A hit gives the entry another life (up to 3). A miss goes to the next entry in
+// turn: if it has no lives left the image gets it, otherwise it loses one and
+// the image isn't cached this time. That way images decoded over and over (a
+// looping animation) hold on to their entries, and ones that aren't any more
+// give theirs up
+//
+static inflate_replay *PNGFindTables(PNGIMAGE *pPage, uint32_t u32CRC)
+{
+    int i;
+    PNGTABLES *pTables;
+    for (i=0; i<pPage->iTableCount; i++) {
+        pTables = &pPage->pTables[i];
+        if (pTables->iSize == pPage->PNGFile.iSize && pTables->u32CRC == u32CRC && pTables->pData == pPage->PNGFile.pData) {
+            if (pTables->iHits < 3)
+                pTables->iHits++;
+            return &pTables->replay;
+        }
+    }
+    pTables = &pPage->pTables[pPage->iTableNext];
+    pPage->iTableNext = (pPage->iTableNext + 1) % pPage->iTableCount;
+    if (pTables->iHits > 0) {
+        pTables->iHits--;
+        return NULL;
+    }
+    pTables->pData = pPage->PNGFile.pData;
+    pTables->iSize = pPage->PNGFile.iSize;
+    pTables->u32CRC = u32CRC;
+    pTables->iHits = 1;
+    pTables->replay.blocks = pTables->replay.used = 0;
+    return &pTables->replay;
+} /* PNGFindTables() */
 //
 // PNGInit
 // Parse the PNG file header and confirm that it's a valid file
@@ -673,44 +1343,81 @@ PNG_STATIC int PNGInit(PNGIMAGE *pPNG)
 // You must call open() before calling decode()
 // This function can be called repeatedly without having
 // to close and re-open the file
+// Stops after iMaxLines lines; if the image isn't finished, the locals are
+// saved in pPage->dec, PNG_DECODE_SUSPENDED is returned and the next call resumes
 //
-PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
+PNG_STATIC int DecodePNGLines(PNGIMAGE *pPage, void *pUser, int iOptions, int iMaxLines)
 {
     int err, y, iLen=0;
     int bDone, iOffset, iFileOffset, iBytesRead;
-    int iMarker=0;
+    int iMarker=0, iLines=0, iRows;
+    int bMem; // source is directly addressable, so inflate reads it in place
+    int bFrame; // inflating straight into pImage, which is also the zlib window
     uint8_t *tmp, *pCurr, *pPrev;
-    z_stream d_stream; /* decompression stream */
+    PNG_DEFILTER_FUNC * const *pfnDeFilter = PNGDeFilterKernels(pPage->iWidth, pPage->iPitch);
+    int iFilterBpp = PNGFilterBpp(pPage->iWidth, pPage->iPitch);
+    z_stream *d_stream = &pPage->dec.d_stream; /* decompression stream; lives in PNGIMAGE so zlib's state stays valid across calls */
     uint8_t *s = pPage->ucFileBuf;
-    struct inflate_state *state;
+    struct inflate_state *state = (struct inflate_state FAR *)pPage->pZLIB; // PNGdec's zlib doesn't allocate its own
+    PNGDECODE *pDec = &pPage->dec;
     
+#ifdef __AVR__
+    bMem = (pPage->PNGFile.pData != NULL && pPage->ucMemType == PNG_MEM_RAM); // AVR flash needs memcpy_P
+#else
+    bMem = (pPage->PNGFile.pData != NULL);
+#endif
+    bFrame = (pPage->pImage != NULL);
+    if (pDec->bSuspended) { // pick up where the last call left off
+        pDec->bSuspended = FALSE;
+        s = pDec->s;
+        pUser = pDec->pUser;
+        iOptions = pDec->iOptions;
+        y = pDec->y;
+        iLen = pDec->iLen;
+        bDone = pDec->bDone;
+        iOffset = pDec->iOffset;
+        iFileOffset = pDec->iFileOffset;
+        iBytesRead = pDec->iBytesRead;
+        iMarker = pDec->iMarker;
+        pCurr = pDec->pCurr;
+        pPrev = pDec->pPrev;
+        err = Z_OK;
+        goto resume_inflate; // we only ever stop between lines inside an IDAT chunk
+    }
     // Either the image buffer must be allocated or a draw callback must be set before entering
-    if (pPage->pImage == NULL && pPage->pfnDraw == NULL) {
+    // (and drawing line by line needs a window; PNG<w, bpp, 0> only has the image buffer)
+    if (pPage->pImage == NULL && (pPage->pfnDraw == NULL || pPage->iWindowBits == 0)) {
         pPage->iError = PNG_NO_BUFFER;
         return 0;
     }
     // Use internal buffer to maintain the current and previous lines
-    y = (int)(intptr_t)&pPage->ucPixels[0];
+    y = (int)(intptr_t)&pPage->pPixels[0];
     y &= 15; // make sure we're 16-byte aligned, -1 for filter byte
     y += (15 - y);
-    pCurr = &pPage->ucPixels[y]; // so that the pixels are 16-byte aligned
+    pCurr = &pPage->pPixels[y]; // so that the pixels are 16-byte aligned
     y += pPage->iPitch + 1; // both lines are 16-byte (minus 1)
     y += (15 - (y & 15));
-    pPrev = &pPage->ucPixels[y];
+    pPrev = &pPage->pPixels[y];
+    memset(pPrev, 0, pPage->iPitch + 1); // the line above the first one is all 0's
     pPage->iError = PNG_SUCCESS;
     // Start decoding the image
     bDone = FALSE;
     // Inflate the compressed image data
     // The allocation functions are disabled and zlib has been modified
     // to not use malloc/free and instead the buffer is part of the PNG class
-    d_stream.zalloc = (alloc_func)0;
-    d_stream.zfree = (free_func)0;
-    d_stream.opaque = (voidpf)0;
+    d_stream->zalloc = (alloc_func)0;
+    d_stream->zfree = (free_func)0;
+    d_stream->opaque = (voidpf)0;
     // Insert the memory pointer here to avoid having to use malloc() inside zlib
-    state = (struct inflate_state FAR *)pPage->ucZLIB;
-    d_stream.state = (struct internal_state FAR *)state;
-    state->window = &pPage->ucZLIB[sizeof(inflate_state)]; // point to 32k dictionary buffer
-    err = inflateInit(&d_stream);
+    d_stream->state = (struct internal_state FAR *)state;
+    if (bFrame) { // the image buffer holds every line, so it's all the history inflate needs
+        state->window = pPage->pImage;
+        err = inflateInit2(d_stream, 15);
+        state->inplace = 1;
+    } else {
+        state->window = &pPage->pZLIB[sizeof(inflate_state)]; // point to the (1 << iWindowBits) dictionary buffer
+        err = inflateInit2(d_stream, pPage->iWindowBits);
+    }
 #ifdef FUTURE
 //    if (inpage->cCompression == PIL_COMP_IPHONE_FLATE)
 //        err = mz_inflateInit2(&d_stream, -15); // undocumented option which ignores header and crcs
@@ -720,20 +1427,26 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
     
     iFileOffset = 8; // skip PNG file signature
     iOffset = 0; // internal buffer offset starts at 0
-    // Read some data to start
-    (*pPage->pfnSeek)(&pPage->PNGFile, iFileOffset);
-    iBytesRead = (*pPage->pfnRead)(&pPage->PNGFile, s, PNG_FILE_BUF_SIZE);
-    iFileOffset += iBytesRead;
+    if (bMem) { // the whole file is already "read"; s walks through it instead of ucFileBuf
+        s = &pPage->PNGFile.pData[iFileOffset];
+        iBytesRead = pPage->PNGFile.iSize - iFileOffset;
+        iFileOffset = pPage->PNGFile.iSize;
+    } else {
+        // Read some data to start
+        (*pPage->pfnSeek)(&pPage->PNGFile, iFileOffset);
+        iBytesRead = (*pPage->pfnRead)(&pPage->PNGFile, s, PNG_FILE_BUF_SIZE);
+        iFileOffset += iBytesRead;
+    }
     y = 0;
-    d_stream.avail_out = 0;
-    d_stream.next_out = pPage->pImage;
+    d_stream->avail_out = 0;
+    d_stream->next_out = pPage->pImage;
 
     while (y < pPage->iHeight) { // continue until fully decoded
         // parse the markers until the next data block
     while (!bDone)
     {
         iLen = MOTOLONG(&s[iOffset]); // chunk length
-        if (iLen < 0 || iLen + (iFileOffset - iBytesRead) > pPage->PNGFile.iSize) // invalid data
+        if (iLen < 0 || iLen + (iFileOffset - iBytesRead) > pPage->PNGFile.iSize || (bMem && iOffset + 12 + iLen > iBytesRead)) // invalid data
         {
             pPage->iError = PNG_DECODE_ERROR;
             return 1;
@@ -760,7 +1473,7 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
                     int i, iColors = 1 << pPage->ucBpp;
                     uint16_t usPixel, *d;
                     uint8_t *s = pPage->ucPalette;
-                    d = (uint16_t *)&pPage->ucPixels[sizeof(pPage->ucPixels)-512];
+                    d = (uint16_t *)&pPage->pPixels[pPage->iPixelsSize-512];
                     for (i=0; i<iColors; i++) {
                     usPixel = (s[2] >> 3); // blue
                     usPixel |= ((s[1] >> 2) << 5); // green
@@ -790,6 +1503,11 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
                 }
                 break;
             case 0x49444154: //'IDAT' image data block
+                if (pPage->iTableCount && d_stream->total_in == 0) { // first IDAT; see if we've had this image before
+                    uint32_t u32CRC;
+                    if (PNGChunkCRC(pPage, s, iOffset, iLen, iBytesRead, iFileOffset, &u32CRC))
+                        state->replay = PNGFindTables(pPage, u32CRC);
+                }
                 while (iLen) {
                     if (iOffset >= iBytesRead) {
                         // we ran out of data; get some more
@@ -801,57 +1519,87 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
                         iBytesRead -= iOffset;
                     }
                     if (iBytesRead > iLen) { // we read too much
-                        d_stream.next_in  = &pPage->ucFileBuf[iOffset];
-                        d_stream.avail_in = iLen;
+                        d_stream->next_in  = &s[iOffset];
+                        d_stream->avail_in = iLen;
                         iOffset += iLen; // point to start of next marker
                         iBytesRead -= iLen; // keep remaining byte count
                         iLen = 0; // every byte will be decoded
                     } else {
-                        d_stream.next_in  = &pPage->ucFileBuf[iOffset];
-                        d_stream.avail_in = iBytesRead;
+                        d_stream->next_in  = &s[iOffset];
+                        d_stream->avail_in = iBytesRead;
                         iLen -= iBytesRead;
                         iOffset += iBytesRead;
                         iBytesRead = 0;
                     }
             //        if (iMarker == 0x66644154) // data starts at offset 4 in APNG frame data block
             //        {
-            //            d_stream.next_in += 4;
-            //            d_stream.avail_in -= 4;
+            //            d_stream->next_in += 4;
+            //            d_stream->avail_in -= 4;
             //        }
                     err = 0;
+resume_inflate:
                     while (err == Z_OK) {
-                        if (d_stream.avail_out == 0) { // reset for next line
-                            d_stream.avail_out = pPage->iPitch+1;
-                            d_stream.next_out = pCurr;
+                        if (d_stream->avail_out == 0) { // reset for next line
+                            if (bFrame) { // as many lines as this call has left, straight into the frame
+                                iRows = pPage->iHeight - y;
+                                if (iRows > iMaxLines - iLines)
+                                    iRows = iMaxLines - iLines;
+                                d_stream->avail_out = iRows * (pPage->iPitch+1);
+                                d_stream->next_out = &pPage->pImage[y * (pPage->iPitch+1)];
+                            } else {
+                                d_stream->avail_out = pPage->iPitch+1;
+                                d_stream->next_out = pCurr;
+                            }
                         } // otherwise it could be a continuation of an unfinished line
-                        err = inflate(&d_stream, Z_NO_FLUSH, iOptions & PNG_CHECK_CRC);
-                        if ((err == Z_OK || err == Z_STREAM_END) && d_stream.avail_out == 0) {// successfully decoded line
-                            DeFilter(pCurr, pPrev, pPage->iWidth, pPage->iPitch);
-                            if (pPage->pImage == NULL) { // no image buffer, send it line by line
+                        err = inflate(d_stream, Z_NO_FLUSH, iOptions & PNG_CHECK_CRC);
+                        if ((err == Z_OK || err == Z_STREAM_END) && d_stream->avail_out == 0) {// successfully decoded line(s)
+                            if (bFrame) {
+                                iRows = (int)(d_stream->next_out - pPage->pImage) / (pPage->iPitch+1) - y;
+                                y += iRows;
+                                iLines += iRows;
+                                if (iRows && y == pPage->iHeight) // the history isn't needed any more
+                                    DeFilterFrame(pPage, pfnDeFilter, iFilterBpp, pPrev+1);
+                            } else { // no image buffer, send it line by line
                                 PNGDRAW pngd;
+                                DeFilterLine(pfnDeFilter, pCurr, pPrev, pPage->iPitch, iFilterBpp);
                                 pngd.pUser = pUser;
                                 pngd.iPitch = pPage->iPitch;
                                 pngd.iWidth = pPage->iWidth;
                                 pngd.pPalette = pPage->ucPalette;
-                                pngd.pFastPalette = (iOptions & PNG_FAST_PALETTE) ? (uint16_t *)&pPage->ucPixels[sizeof(pPage->ucPixels)-512] : NULL;
+                                pngd.pFastPalette = (iOptions & PNG_FAST_PALETTE) ? (uint16_t *)&pPage->pPixels[pPage->iPixelsSize-512] : NULL;
                                 pngd.pPixels = pCurr+1;
                                 pngd.iPixelType = pPage->ucPixelType;
                                 pngd.iHasAlpha = pPage->iHasAlpha;
                                 pngd.iBpp = pPage->ucBpp;
                                 pngd.y = y;
                                 (*pPage->pfnDraw)(&pngd);
-                            } else {
-                                // copy to destination bitmap
-                                memcpy(&pPage->pImage[y * pPage->iPitch], &pCurr[1], pPage->iPitch);
+                                y++;
+                                iLines++;
+                                // swap current and previous lines
+                                tmp = pCurr; pCurr = pPrev; pPrev = tmp;
+                            }
+                            if (err == Z_OK && iLines >= iMaxLines && y < pPage->iHeight) {
+                                // used up this call's lines; save our place and return
+                                pDec->pUser = pUser;
+                                pDec->iOptions = iOptions;
+                                pDec->y = y;
+                                pDec->iLen = iLen;
+                                pDec->bDone = bDone;
+                                pDec->iOffset = iOffset;
+                                pDec->iFileOffset = iFileOffset;
+                                pDec->iBytesRead = iBytesRead;
+                                pDec->iMarker = iMarker;
+                                pDec->pCurr = pCurr;
+                                pDec->pPrev = pPrev;
+                                pDec->s = s;
+                                pDec->bSuspended = TRUE;
+                                return PNG_DECODE_SUSPENDED;
                             }
-                            y++;
-                        // swap current and previous lines
-                        tmp = pCurr; pCurr = pPrev; pPrev = tmp;
                         } else { // some error
                             tmp = NULL;
                         }
                     }
-                    if (err == Z_STREAM_END && d_stream.avail_out == 0) {
+                    if (err == Z_STREAM_END && d_stream->avail_out == 0) {
                         // successful decode, stop here
                         y = pPage->iHeight;
                         bDone = TRUE;
@@ -864,13 +1612,16 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
                         y |= 0; // need more data
                     }
                 } // while (iLen)
-                if (y != pPage->iHeight && iFileOffset < pPage->PNGFile.iSize) {
+                if (bMem) { // step past this chunk's data instead of moving what's left of it
+                    s += iOffset;
+                    iOffset = 0;
+                } else if (y != pPage->iHeight) {
                     // need to read more IDAT chunks
-                    if (iBytesRead) { // data remaining in buffer
+                    if (iBytesRead) { // data remaining in buffer (even if it's the end of the file)
                         // move the data down
                         memmove(pPage->ucFileBuf, &pPage->ucFileBuf[iOffset], iBytesRead);
                         iOffset = 0;
-                    } else {
+                    } else if (iFileOffset < pPage->PNGFile.iSize) {
                         iBytesRead = (*pPage->pfnRead)(&pPage->PNGFile, pPage->ucFileBuf,  PNG_FILE_BUF_SIZE);
                         iFileOffset += iBytesRead;
                         iOffset = 0;
@@ -907,7 +1658,13 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
 #endif
         } // switch
         iOffset += (iLen + 4); // skip data + CRC
-        if (iOffset > iBytesRead-8) { // need to read more data
+        if (bMem) {
+            if (iOffset > iBytesRead-8 && !bDone) { // ran off the end without finishing the image
+                pPage->iError = PNG_DECODE_ERROR;
+                y = pPage->iHeight;
+                bDone = TRUE;
+            }
+        } else if (iOffset > iBytesRead-8) { // need to read more data
             iFileOffset += (iOffset - iBytesRead);
             (*pPage->pfnSeek)(&pPage->PNGFile, iFileOffset);
             iBytesRead = (*pPage->pfnRead)(&pPage->PNGFile, s, PNG_FILE_BUF_SIZE);
@@ -916,6 +1673,14 @@ PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
         }
     } // while !bDone
     } // while y < height
-    err = inflateEnd(&d_stream);
+    err = inflateEnd(d_stream);
     return pPage->iError;
+} /* DecodePNGLines() */
+//
+// Decode the whole image in one call
+//
+PNG_STATIC int DecodePNG(PNGIMAGE *pPage, void *pUser, int iOptions)
+{
+    pPage->dec.bSuspended = FALSE; // a full decode always starts over
+    return DecodePNGLines(pPage, pUser, iOptions, 0x7fffffff);
 } /* DecodePNG() */
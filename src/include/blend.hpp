@@ -0,0 +1,53 @@
+#ifndef BLEND_HPP
+#define BLEND_HPP
+
+#include <stdint.h>
+
+/* How a layer's pixels combine with what's under them. Sources are premultiplied: color already scaled by alpha, like PNGdec's conversions with a background of `0`. */
+enum BlendModes {
+    BLEND_OVER,   // `src + dst*(1 - alpha)`. Normal transparency.
+    BLEND_ADD,    // `dst + src`, saturating. Glow and bloom layers.
+    BLEND_SCREEN, // `src + dst - src*dst`. Like add, but eases off toward white instead of clipping.
+    BLEND_MODES,
+};
+
+/* `x*y/255`, rounded. Exact for all byte inputs, with no divide. */
+static inline uint8_t mul255(uint32_t x, uint32_t y) {
+    uint32_t t = x*y + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+/* `blendRow()`'s loop, with the opacity test hoisted out. */
+template <int Mode, bool Faded>
+void blendPixels(uint8_t* dst, const uint8_t* src, const uint8_t* alpha, int count, uint8_t opacity) {
+    for (int i = 0; i < count; i++) {
+        uint32_t a = (Faded) ? mul255(alpha[i], opacity) : alpha[i];
+        for (int c = 0; c < 3; c++) {
+            uint32_t s = (Faded) ? mul255(src[c], opacity) : src[c];
+            uint32_t d = dst[c];
+            uint32_t out;
+            if (Mode == BLEND_OVER) {
+                out = s + mul255(d, 255 - a);
+            } else if (Mode == BLEND_ADD) {
+                out = d + s;
+            } else {
+                out = s + d - mul255(s, d);
+            }
+            dst[c] = (out > 255) ? 255 : out; // Over only overflows if a color is brighter than its alpha, which bloom's rounding can do.
+        }
+        dst += 3;
+        src += 3;
+    }
+}
+
+/* Blends `count` premultiplied RGB888 pixels at `src`, with one alpha byte each at `alpha`, into RGB888 `dst` by `Mode`, fading them by `opacity` first (`255` is as-is). Branch-free byte math per channel, so the compiler can unroll and vectorize it. */
+template <int Mode>
+void blendRow(uint8_t* dst, const uint8_t* src, const uint8_t* alpha, int count, uint8_t opacity) {
+    if (opacity == 255) {
+        blendPixels<Mode, false>(dst, src, alpha, count, opacity);
+    } else {
+        blendPixels<Mode, true>(dst, src, alpha, count, opacity);
+    }
+}
+
+#endif
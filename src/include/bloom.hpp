@@ -0,0 +1,31 @@
+#ifndef BLOOM_HPP
+#define BLOOM_HPP
+
+#include <stdint.h>
+
+#include "hsv.hpp"
+
+const float bloomScaleStep = 0.05f; // IR `bloomUp`/`bloomDown` change the bloom scale by this...
+const float bloomScaleMax  = 0.39f; // ...going up while it's under this...
+const float bloomScaleMin  = 0.01f; // ...and down while it's over this.
+
+/* Fills `table` with `x + (255 - x)*scale` for every `x`. It's the same expression and truncation the old per-pixel float bloom used on V and S, so looking a value up gives exactly what that computed. */
+inline void buildBloomTable(uint8_t* table, float scale) {
+    for (int x = 0; x < 256; x++) {
+        table[x] = x + (255 - x)*scale;
+    }
+}
+
+/* Applies bloom through `bloomTable` to a run of `count` (up to 64) pixels, raising V and S. The HSV round trip goes a whole run at a time. `pixels` and `effected` may be the same. */
+inline void effectRow(const rgb24* pixels, rgb24* effected, int count, const uint8_t* bloomTable) {
+    hsv24 hsv[64];
+
+    rgbToHsvRow(pixels, hsv, count);
+    for (int i = 0; i < count; i++) {
+        hsv[i].v = bloomTable[hsv[i].v];
+        hsv[i].s = bloomTable[hsv[i].s];
+    }
+    hsvToRgbRow(hsv, effected, count);
+}
+
+#endif
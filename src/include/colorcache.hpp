@@ -0,0 +1,67 @@
+#ifndef COLORCACHE_HPP
+#define COLORCACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/* Remembers what a color-to-color function gave for recently seen colors, so a frame's pixels map in one lookup each. Direct-mapped by a hash of the color: a miss (or a collision) runs the function, batched per `apply()` call, and overwrites the slot. Pixel art frames reuse a handful of colors, so nearly every pixel hits, and the function's cost stops mattering per pixel. Output is always exactly the function's. `clear()` whenever the function changes. `Pixel` needs `red`, `green` and `blue` bytes (`rgb24`). */
+template <typename Pixel, int SlotBits = 10>
+struct ColorCache {
+    static constexpr int slots = 1 << SlotBits;
+
+    uint32_t keys[slots];   // `0x01RRGGBB` for a filled slot, `0` for empty.
+    Pixel    values[slots];
+    uint32_t hits;
+    uint32_t misses;
+
+    void clear() {
+        memset(keys, 0, sizeof(keys));
+    }
+
+    static uint32_t key(const Pixel& p) {
+        return 0x01000000 | ((uint32_t)p.red << 16) | ((uint32_t)p.green << 8) | p.blue;
+    }
+
+    static int slot(uint32_t key) {
+        return (key*2654435761u) >> (32 - SlotBits); // Fibonacci hashing, so nearby colors spread out.
+    }
+
+    /* Maps `count` pixels, running `rowFunc(const Pixel* in, Pixel* out, int count)` once per 64 pixels on just the ones that missed. `in` and `out` may be the same. */
+    template <typename RowFunc>
+    void apply(const Pixel* in, Pixel* out, int count, RowFunc rowFunc) {
+        Pixel   missIn[64], missOut[64];
+        uint8_t missAt[64];
+
+        for (int start = 0; start < count; start += 64) {
+            int n = (count - start < 64) ? count - start : 64;
+            int missed = 0;
+
+            for (int i = start; i < start + n; i++) {
+                uint32_t k = key(in[i]);
+                int      s = slot(k);
+                if (keys[s] == k) {
+                    out[i] = values[s];
+                } else {
+                    missIn[missed] = in[i];
+                    missAt[missed++] = i - start;
+                }
+            }
+            hits += n - missed;
+            misses += missed;
+            if (!missed) {
+                continue;
+            }
+
+            rowFunc(missIn, missOut, missed);
+            for (int j = 0; j < missed; j++) {
+                uint32_t k = key(missIn[j]);
+                int      s = slot(k);
+                keys[s] = k;
+                values[s] = missOut[j];
+                out[start + missAt[j]] = missOut[j];
+            }
+        }
+    }
+};
+
+#endif
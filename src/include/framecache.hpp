@@ -0,0 +1,56 @@
+#ifndef FRAMECACHE_HPP
+#define FRAMECACHE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hsv.hpp" // `rgb24`.
+#include "PNGdec/PNGdec.h"
+
+struct FrameCache { // A still image decoded once and kept post-conversion, so effects run on it without re-decoding. One layer's frame buffer.
+    const uint8_t* source; // PNG data this was decoded from. `NULL` if the slot is unused.
+    bool     failed; // `source` didn't decode. Kept so it isn't tried again.
+    uint8_t  rowOpacity[64]; // `PNG_MASK_*` summary per row.
+    rgb24    pixels[64][64]; // Premultiplied: already scaled by `alpha`, as if over black.
+    uint8_t  alpha[64][64];
+    uint8_t  opaque[64][8]; // Bit set where `alpha` isn't `0`.
+    int      paletteCount; // Palette entries if the image is indexed, else `0`.
+    rgb24    palette[256]; // Converted like `pixels`, so `palette[indexes[y][x]] == pixels[y][x]`.
+    uint8_t  paletteUsed[256]; // Only these entries get bloomed each frame.
+    uint8_t  indexes[64][64];
+};
+
+/* Empties `pCache` for a new decode. */
+inline void clearCache(FrameCache* pCache) {
+    pCache->source = NULL;
+    pCache->failed = false;
+    memset(pCache->rowOpacity, 0, sizeof(pCache->rowOpacity)); // Rows past the image's end stay undrawn.
+    pCache->paletteCount = 0;
+    memset(pCache->paletteUsed, 0, sizeof(pCache->paletteUsed));
+}
+
+/* Converts one decoded line into `pCache` with `decoder`'s line converters. They only read `pDraw`, so any `PNG` works for lines from any decoder, `QOI`'s included. */
+inline void cacheLine(PNGDecoder& decoder, PNGDRAW* pDraw, FrameCache* pCache) {
+    if (pDraw->y >= 64 || pDraw->iWidth > 64) {
+        return; // Not a panel-sized image. Rows are 64 wide, so drop it rather than overrun them.
+    }
+
+    uint32_t bkgd = 0x00000000; // Mixing with black premultiplies by alpha, which is what `compose()` blends.
+
+    if (pDraw->y == 0) {
+        uint8_t paletteOpaque[32];
+        pCache->paletteCount = decoder.getPaletteAsRGB888Masked(pDraw, (uint8_t*)pCache->palette, paletteOpaque, 1, bkgd);
+    }
+
+    pCache->rowOpacity[pDraw->y] = decoder.getLineAsRGB888Masked(pDraw, (uint8_t*)pCache->pixels[pDraw->y], pCache->opaque[pDraw->y], 1, bkgd);
+    decoder.getLineAsAlpha(pDraw, pCache->alpha[pDraw->y]);
+
+    if (pCache->paletteCount) {
+        decoder.getLineAsIndexes(pDraw, pCache->indexes[pDraw->y]);
+        for (int x = 0; x < 64; x++) {
+            pCache->paletteUsed[pCache->indexes[pDraw->y][x]] = 1;
+        }
+    }
+}
+
+#endif
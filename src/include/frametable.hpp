@@ -0,0 +1,155 @@
+#ifndef FRAMETABLE_HPP
+#define FRAMETABLE_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A contiguous file read straight off the card by sector, so reading it takes no filesystem calls at all. `Card` needs `readSectors(sector, buffer, count)`, like SdFat's `SdCard`. */
+template <typename Card>
+struct SectorFile {
+    static constexpr uint32_t sectorSize = 512;
+
+    Card*    card;
+    uint32_t firstSector; // `0` if closed. Sector `0` is never a file's.
+    uint32_t size;
+    uint32_t pos;
+    uint32_t bounceSector; // Which sector `bounce` holds, or `0`.
+    uint8_t  bounce[sectorSize] __attribute__((aligned(4))); // For reads that start or end mid-sector.
+
+    void open(Card* c, uint32_t first, uint32_t length) {
+        card = c;
+        firstSector = first;
+        size = length;
+        pos = 0;
+        bounceSector = 0;
+    }
+
+    explicit operator bool() const { return card && firstSector; }
+
+    bool seekSet(uint64_t position) {
+        if (position > size) {
+            return false;
+        }
+        pos = (uint32_t)position;
+        return true;
+    }
+
+    /* Whole sectors go straight into `buffer`; only the ends of a read go through `bounce`. Returns bytes read, or `-1` if the card failed before any. */
+    int read(void* buffer, size_t length) {
+        uint8_t* dst  = (uint8_t*)buffer;
+        size_t   done = 0;
+
+        length = (length > size - pos) ? size - pos : length;
+        while (done < length) {
+            uint32_t sector = firstSector + pos/sectorSize;
+            uint32_t offset = pos % sectorSize;
+            size_t   n;
+            if (offset == 0 && length - done >= sectorSize) {
+                n = (length - done)/sectorSize;
+                if (!card->readSectors(sector, &dst[done], n)) {
+                    break;
+                }
+                n *= sectorSize;
+            } else {
+                if (sector != bounceSector) {
+                    bounceSector = 0;
+                    if (!card->readSectors(sector, bounce, 1)) {
+                        break;
+                    }
+                    bounceSector = sector;
+                }
+                n = (sectorSize - offset < length - done) ? sectorSize - offset : length - done;
+                memcpy(&dst[done], &bounce[offset], n);
+            }
+            done += n;
+            pos  += n;
+        }
+
+        return (done || !length) ? (int)done : -1;
+    }
+};
+
+/* What `ReadAhead` reads an image from: a kept-open `file`, or `sectors` when the frame's file is contiguous. One per open handle, so `ReadAhead::attach()` can tell them apart. */
+template <typename File, typename Card>
+struct FrameSource {
+    File*            file;
+    SectorFile<Card> sectors;
+    bool             bySector;
+
+    explicit operator bool() { return (bySector) ? (bool)sectors : (file && *file); }
+
+    bool seekSet(uint64_t position) {
+        return (bySector) ? sectors.seekSet(position) : file->seekSet(position);
+    }
+
+    int read(void* buffer, size_t length) {
+        return (bySector) ? sectors.read(buffer, length) : file->read(buffer, length);
+    }
+};
+
+/* Where each of an animation's frame files is, found once by `scan()` so playback never searches the directory. Contiguous files (what a freshly copied card almost always has) also keep their sector range, so they're read by sector without touching the filesystem. `File` is SdFat's `FsFile`, or the bench's stand-in. */
+template <typename File, typename Card, int MaxFrames = 512>
+struct FrameTable {
+    struct Frame {
+        uint32_t dirIndex;    // For `open(dir, dirIndex)`. `0xFFFFFFFF` if there's no such frame.
+        uint32_t firstSector; // `0` unless the file is contiguous.
+        uint32_t size;
+        bool     isQOI;       // Whether this is the `.qoi`, which wins over a `.png` of the same frame.
+    };
+
+    Frame frames[MaxFrames]; // Frame `n` at `[n - 1]`.
+    int   count; // Frames `1..count` all exist.
+
+    /* Records every `{name}{n}.png` or `{name}{n}.qoi` in `dir`. Playback stops at the first missing frame. Returns `count`. */
+    int scan(File* dir, const char* name) {
+        File   file;
+        size_t nameLen = strlen(name);
+
+        for (int i = 0; i < MaxFrames; i++) {
+            frames[i].dirIndex = 0xFFFFFFFF;
+            frames[i].isQOI = false;
+        }
+        count = 0;
+        while (file.openNext(dir, O_RDONLY)) {
+            char fileName[64] = {0};
+            file.getName(fileName, sizeof(fileName));
+
+            char* end;
+            long  frameNum = (strncmp(fileName, name, nameLen) == 0) ? strtol(fileName + nameLen, &end, 10) : 0;
+            bool  isQOI = (frameNum >= 1 && strcmp(end, ".qoi") == 0);
+            if (frameNum >= 1 && frameNum <= MaxFrames && end != fileName + nameLen && (isQOI || (strcmp(end, ".png") == 0 && !frames[frameNum - 1].isQOI))) {
+                Frame    *frame = &frames[frameNum - 1];
+                uint32_t  lastSector;
+                frame->dirIndex = file.dirIndex();
+                frame->size = (uint32_t)file.fileSize();
+                frame->isQOI = isQOI;
+                if (!file.contiguousRange(&frame->firstSector, &lastSector)) {
+                    frame->firstSector = 0;
+                }
+            }
+
+            file.close();
+        }
+
+        while (count < MaxFrames && frames[count].dirIndex != 0xFFFFFFFF) {
+            count++;
+        }
+        return count;
+    }
+
+    /* Points `source` at frame `frameNum`: by sector from `card` if it's contiguous, with no filesystem calls, else opened by directory index from `dir` into `file`. Returns `false` if it won't open. */
+    bool open(int frameNum, File* dir, File* file, Card* card, FrameSource<File, Card>* source) {
+        Frame *frame = &frames[frameNum - 1];
+
+        source->bySector = (frame->firstSector != 0);
+        if (source->bySector) {
+            source->sectors.open(card, frame->firstSector, frame->size);
+            return true;
+        }
+        source->file = file;
+        return file->open(dir, frame->dirIndex, O_RDONLY);
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef GLITCHRAND_HPP
+#define GLITCHRAND_HPP
+
+#include <stdint.h>
+
+/* xoshiro128++ (Blackman & Vigna): a small, fast generator with 128 bits of state. The same `seed()` gives the same sequence on the Teensy and on a host, so glitched frames can be replayed. */
+struct Xoshiro128 {
+    uint32_t s[4];
+
+    static uint32_t rotl(uint32_t x, int k) {
+        return (x << k) | (x >> (32 - k));
+    }
+
+    /* Fills the state from `value` with splitmix32, so nearby seeds still start far apart (and never all zero). */
+    void seed(uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            uint32_t z = (value += 0x9e3779b9);
+            z = (z ^ (z >> 16))*0x85ebca6b;
+            z = (z ^ (z >> 13))*0xc2b2ae35;
+            s[i] = z ^ (z >> 16);
+        }
+    }
+
+    uint32_t next() {
+        uint32_t result = rotl(s[0] + s[3], 7) + s[0];
+        uint32_t t = s[1] << 9;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 11);
+        return result;
+    }
+
+    /* `-1` or `1`. */
+    int sign() {
+        return (next() >> 31) ? -1 : 1;
+    }
+
+    /* `next() < threshold(chance)` passes with probability `chance`. */
+    static uint32_t threshold(float chance) {
+        return (chance <= 0.0f) ? 0 : (chance >= 1.0f) ? 0xffffffff : (uint32_t)(chance*4294967296.0);
+    }
+};
+
+/* Inverse CDF of `floor(sqrt(uniform(0, m²)))`, which gives `k` in `0..m - 1` with probability `(2k + 1)/m²` (so it leans toward `m`). Built once per magnitude; a draw is then one lookup by the top `Bits` of a random word, each entry standing for the middle of its `1/2^Bits` slice. Magnitudes are capped at 256. */
+template <int Bits = 10>
+struct WeightedTable {
+    int     magnitude = -1; // `-1` until built.
+    uint8_t values[1 << Bits];
+
+    void build(int m) {
+        m = (m < 0) ? 0 : (m > 256) ? 256 : m;
+        magnitude = m;
+
+        uint32_t squared = m*m, k = 0;
+        for (int i = 0; i < (1 << Bits); i++) {
+            uint32_t u = ((2*i + 1)*squared) >> (Bits + 1); // Slice `i`'s midpoint in `0..m² - 1`.
+            while ((k + 1)*(k + 1) <= u) {
+                k++; // `u` only grows, so so does `k`.
+            }
+            values[i] = k;
+        }
+    }
+
+    int draw(uint32_t random) const {
+        return values[random >> (32 - Bits)];
+    }
+};
+
+#endif
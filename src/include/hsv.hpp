@@ -1,7 +1,16 @@
 #ifndef HSV_HPP
 #define HSV_HPP
 
+#ifdef __LINUX__ /* Host builds (src/bench/) have no SmartMatrix; this is its `rgb24` layout. */
+#include <stdint.h>
+typedef struct rgb24 {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} rgb24;
+#else
 #include <SmartMatrix.h>
+#endif
 
 typedef struct hsv24 {
     unsigned char h; /* 0-255 not 0-360 */
@@ -87,4 +96,64 @@ hsv24 rgbToHsv(rgb24 rgb)
     return hsv;
 }
 
-#endif
\ No newline at end of file
+/* Row versions of the two functions above, for whole lines at a time. Same output as calling them per pixel, bit for bit, but with no divides or switch: the divides become multiplies by `hsvReciprocals`, and the region picks come from `hsvRegionPicks`. */
+
+/* `ceil(2^24 / x)`, and `0` for `x == 0`. Exact as a divide for every numerator `rgbToHsv` uses: `n*hsvReciprocals[x] >> 24 == n / x` while `n*x < 2^24`, and `255*(max - min)` and `43*|h diff|` both stay under that with `x` the max or the max - min. */
+static const uint32_t hsvReciprocals[256] = {
+#define HSV_RECIPROCAL(x) ((x) ? (uint32_t)(((1UL << 24) + (x) - 1) / ((x) | !(x))) : 0) /* `| !(x)` only quiets the divide-by-zero warning for the `0` entry. */
+#define HSV_RECIPROCALS_8(x) HSV_RECIPROCAL(x), HSV_RECIPROCAL(x + 1), HSV_RECIPROCAL(x + 2), HSV_RECIPROCAL(x + 3), HSV_RECIPROCAL(x + 4), HSV_RECIPROCAL(x + 5), HSV_RECIPROCAL(x + 6), HSV_RECIPROCAL(x + 7)
+#define HSV_RECIPROCALS_64(x) HSV_RECIPROCALS_8(x), HSV_RECIPROCALS_8(x + 8), HSV_RECIPROCALS_8(x + 16), HSV_RECIPROCALS_8(x + 24), HSV_RECIPROCALS_8(x + 32), HSV_RECIPROCALS_8(x + 40), HSV_RECIPROCALS_8(x + 48), HSV_RECIPROCALS_8(x + 56)
+    HSV_RECIPROCALS_64(0), HSV_RECIPROCALS_64(64), HSV_RECIPROCALS_64(128), HSV_RECIPROCALS_64(192)
+#undef HSV_RECIPROCALS_64
+#undef HSV_RECIPROCALS_8
+#undef HSV_RECIPROCAL
+};
+
+/* Which of `{ v, p, q, t }` each of red, green and blue gets, per `hsvToRgb` region. Region 6 is grey (`s == 0`), which is `v` for all three. */
+static const uint8_t hsvRegionPicks[7][3] = {
+    { 0, 3, 1 }, { 2, 0, 1 }, { 1, 0, 3 }, { 1, 2, 0 }, { 3, 1, 0 }, { 0, 1, 2 }, { 0, 0, 0 },
+};
+
+void hsvToRgbRow(const hsv24 *hsv, rgb24 *rgb, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int h = hsv[i].h, s = hsv[i].s, v = hsv[i].v;
+        unsigned int region = (h * 191) >> 13; /* h / 43 for every h <= 255 */
+        unsigned int remainder = (h - region * 43) * 6;
+        uint8_t pvqt[4];
+
+        pvqt[0] = v;
+        pvqt[1] = (v * (255 - s)) >> 8;
+        pvqt[2] = (v * (255 - ((s * remainder) >> 8))) >> 8;
+        pvqt[3] = (v * (255 - ((s * (255 - remainder)) >> 8))) >> 8;
+
+        const uint8_t *pick = hsvRegionPicks[(s) ? region : 6];
+        rgb[i].red = pvqt[pick[0]];
+        rgb[i].green = pvqt[pick[1]];
+        rgb[i].blue = pvqt[pick[2]];
+    }
+}
+
+void rgbToHsvRow(const rgb24 *rgb, hsv24 *hsv, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int r = rgb[i].red, g = rgb[i].green, b = rgb[i].blue;
+        int rgbMin = r < g ? (r < b ? r : b) : (g < b ? g : b);
+        int rgbMax = r > g ? (r > b ? r : b) : (g > b ? g : b);
+        int delta = rgbMax - rgbMin;
+
+        /* Hue numerator and base the way `rgbToHsv` picks them: red wins ties, then green. */
+        int diff = (rgbMax == r) ? g - b : (rgbMax == g) ? b - r : r - g;
+        int base = (rgbMax == r) ? 0 : (rgbMax == g) ? 85 : 171;
+        int sign = diff >> 31; /* -1 or 0, so the divide truncates toward zero like `/` does */
+        int hue = (int)(((uint32_t)(43 * ((diff ^ sign) - sign)) * hsvReciprocals[delta]) >> 24);
+
+        hsv[i].v = rgbMax;
+        hsv[i].s = ((uint32_t)(255 * delta) * hsvReciprocals[rgbMax]) >> 24; /* 0 when rgbMax is, since its reciprocal is */
+        hsv[i].h = base + ((hue ^ sign) - sign); /* Grey has delta 0 and rgbMax == r, so this is 0 too. */
+    }
+}
+
+#endif
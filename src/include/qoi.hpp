@@ -0,0 +1,252 @@
+#ifndef QOI_HPP
+#define QOI_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "PNGdec/PNGdec.h"
+
+/* QOI ("Quite OK Image", https://qoiformat.org) decoder with `PNG`'s calling conventions: the same open/read/seek/close/draw callbacks, `decode()`/`decodeLines()` and `PNG_*` error codes. Every row goes to the draw callback as a `PNG_PIXEL_TRUECOLOR_ALPHA` 8-bit `PNGDRAW`, so a `PNG`'s `getLineAs*()` converters work on it unchanged. `iHasAlpha` is set for 4-channel files; 3-channel files come out with alpha 255. Images wider than `MaxWidth` fail with `PNG_TOO_BIG`. File input goes through a `BufferSize`-byte buffer; `openRAM()` data is decoded in place. */
+template <int MaxWidth = 64, int BufferSize = 512>
+class QOI {
+public:
+    static constexpr int headerSize = 14; // "qoif", u32 width, u32 height, u8 channels, u8 colorspace. Big-endian.
+
+    /* Whether `data` (at least 4 bytes) starts with QOI's magic. */
+    static bool isQOI(const uint8_t* data) {
+        return memcmp(data, "qoif", 4) == 0;
+    }
+
+    int openRAM(const uint8_t* pData, int iDataSize, PNG_DRAW_CALLBACK* pfnDraw) {
+        reset();
+        pfnDraw_ = pfnDraw;
+        pIn_ = pData;
+        pEnd_ = pData + iDataSize;
+        return parseHeader();
+    }
+
+    int open(const char* szFilename, PNG_OPEN_CALLBACK* pfnOpen, PNG_CLOSE_CALLBACK* pfnClose, PNG_READ_CALLBACK* pfnRead, PNG_SEEK_CALLBACK* pfnSeek, PNG_DRAW_CALLBACK* pfnDraw) {
+        reset();
+        pfnRead_ = pfnRead;
+        pfnSeek_ = pfnSeek;
+        pfnClose_ = pfnClose;
+        pfnDraw_ = pfnDraw;
+        file_.fHandle = (*pfnOpen)(szFilename, &file_.iSize);
+        if (file_.fHandle == NULL) {
+            return iError_ = PNG_INVALID_FILE;
+        }
+        (*pfnSeek_)(&file_, 0);
+        pIn_ = pEnd_ = buffer_;
+        return parseHeader();
+    }
+
+    void close() {
+        if (pfnClose_ && file_.fHandle) {
+            (*pfnClose_)(file_.fHandle);
+        }
+        file_.fHandle = NULL;
+    }
+
+    int decode(void* pUser, int iOptions) {
+        return decodeLines(pUser, iOptions, 0x7fffffff);
+    }
+
+    /* Like `PNG::decodeLines()`: decodes at most `iMaxLines` more rows and returns `PNG_DECODE_SUSPENDED` if there are any left. Nothing else may use the file until the decode finishes. `pUser` only applies to the first call of each image. */
+    int decodeLines(void* pUser, int iOptions, int iMaxLines) {
+        (void)iOptions; // No QOI options.
+        if (iError_ != PNG_SUCCESS && iError_ != PNG_DECODE_SUSPENDED) {
+            return iError_;
+        }
+        if (y_ == 0) {
+            pUser_ = pUser;
+        }
+
+        PNGDRAW draw;
+        draw.iWidth = iWidth_;
+        draw.iPitch = iWidth_*4;
+        draw.iPixelType = PNG_PIXEL_TRUECOLOR_ALPHA;
+        draw.iBpp = 8;
+        draw.iHasAlpha = (iChannels_ == 4);
+        draw.pUser = pUser_;
+        draw.pPalette = NULL;
+        draw.pFastPalette = NULL;
+        draw.pPixels = row_;
+
+        for (int lines = 0; y_ < iHeight_; y_++, lines++) {
+            if (lines == iMaxLines) {
+                return iError_ = PNG_DECODE_SUSPENDED;
+            }
+            if (!decodeRow()) {
+                return iError_ = PNG_DECODE_ERROR;
+            }
+            draw.y = y_;
+            if (pfnDraw_) {
+                (*pfnDraw_)(&draw);
+            }
+        }
+        return iError_ = PNG_SUCCESS;
+    }
+
+    int getWidth() { return iWidth_; }
+    int getHeight() { return iHeight_; }
+    int hasAlpha() { return iChannels_ == 4; }
+    int getLastError() { return iError_; }
+    int isDecoding() { return iError_ == PNG_DECODE_SUSPENDED; }
+
+private:
+    struct Pixel { uint8_t r, g, b, a; };
+
+    enum { // Op tags. The 8-bit ones are checked first; the rest are the top two bits.
+        OP_INDEX = 0x00,
+        OP_DIFF  = 0x40,
+        OP_LUMA  = 0x80,
+        OP_RUN   = 0xc0,
+        OP_RGB   = 0xfe,
+        OP_RGBA  = 0xff,
+    };
+
+    PNG_READ_CALLBACK*  pfnRead_;
+    PNG_SEEK_CALLBACK*  pfnSeek_;
+    PNG_CLOSE_CALLBACK* pfnClose_;
+    PNG_DRAW_CALLBACK*  pfnDraw_;
+    PNGFILE        file_;
+    void*          pUser_;
+    const uint8_t* pIn_;  // Next unread byte, in `buffer_` or the `openRAM()` data.
+    const uint8_t* pEnd_; // End of what's been read so far.
+    int     iWidth_, iHeight_, iChannels_;
+    int     iError_;
+    int     y_;     // Next row to decode.
+    int     iRun_;  // Repeats of `px_` still owed to the next rows.
+    Pixel   px_;
+    Pixel   index_[64]; // Previously seen pixels, by `hash()`.
+    uint8_t row_[MaxWidth*4];
+    uint8_t buffer_[BufferSize];
+
+    static int hash(Pixel p) {
+        return (p.r*3 + p.g*5 + p.b*7 + p.a*11) & 63;
+    }
+
+    void reset() {
+        pfnRead_ = NULL;
+        pfnSeek_ = NULL;
+        pfnClose_ = NULL;
+        memset(&file_, 0, sizeof(file_));
+        iWidth_ = iHeight_ = iChannels_ = 0;
+        iError_ = PNG_SUCCESS;
+        y_ = 0;
+        iRun_ = 0;
+        px_ = { 0, 0, 0, 255 };
+        memset(index_, 0, sizeof(index_));
+    }
+
+    /* Tops the buffer up so at least `n` bytes are unread, if the file has them. RAM data is all there already. */
+    void refill(int n) {
+        if (!pfnRead_ || pEnd_ - pIn_ >= n) {
+            return;
+        }
+        int32_t kept = pEnd_ - pIn_;
+        memmove(buffer_, pIn_, kept);
+        int32_t got = (*pfnRead_)(&file_, buffer_ + kept, BufferSize - kept);
+        pIn_ = buffer_;
+        pEnd_ = buffer_ + kept + ((got > 0) ? got : 0);
+    }
+
+    static uint32_t be32(const uint8_t* p) {
+        return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    int parseHeader() {
+        refill(headerSize);
+        if (pEnd_ - pIn_ < headerSize || !isQOI(pIn_)) {
+            return iError_ = PNG_INVALID_FILE;
+        }
+        uint32_t width = be32(pIn_ + 4), height = be32(pIn_ + 8);
+        iChannels_ = pIn_[12];
+        pIn_ += headerSize;
+        if (width == 0 || height == 0 || (iChannels_ != 3 && iChannels_ != 4)) {
+            return iError_ = PNG_INVALID_FILE;
+        }
+        if (width > (uint32_t)MaxWidth || height > 0x7fffffff) {
+            return iError_ = PNG_TOO_BIG;
+        }
+        iWidth_ = width;
+        iHeight_ = height;
+        return PNG_SUCCESS;
+    }
+
+    /* Decodes row `y_` into `row_`. Returns `false` if the data runs out first. */
+    bool decodeRow() {
+        uint8_t*       d = row_;
+        const uint8_t* p = pIn_;
+        Pixel          px = px_;
+
+        for (int x = 0; x < iWidth_; x++) {
+            if (iRun_ > 0) {
+                iRun_--;
+            } else {
+                if (pEnd_ - p < 5) { // Longest op is 5 bytes.
+                    pIn_ = p;
+                    refill(5);
+                    p = pIn_;
+                }
+                if (p == pEnd_) {
+                    return false;
+                }
+                int b1 = *p;
+                int len = (b1 == OP_RGBA) ? 5 : (b1 == OP_RGB) ? 4 : ((b1 & 0xc0) == OP_LUMA) ? 2 : 1;
+                if (pEnd_ - p < len) {
+                    return false;
+                }
+                p++;
+
+                if (b1 == OP_RGB) {
+                    px.r = p[0];
+                    px.g = p[1];
+                    px.b = p[2];
+                    p += 3;
+                } else if (b1 == OP_RGBA) {
+                    px.r = p[0];
+                    px.g = p[1];
+                    px.b = p[2];
+                    px.a = p[3];
+                    p += 4;
+                } else {
+                    switch (b1 & 0xc0) {
+                        case OP_INDEX:
+                            px = index_[b1];
+                            break;
+                        case OP_DIFF:
+                            px.r += ((b1 >> 4) & 3) - 2;
+                            px.g += ((b1 >> 2) & 3) - 2;
+                            px.b += (b1 & 3) - 2;
+                            break;
+                        case OP_LUMA: {
+                            int vg = (b1 & 0x3f) - 32;
+                            int b2 = *p++;
+                            px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                            px.g += vg;
+                            px.b += vg - 8 + (b2 & 0x0f);
+                            break;
+                        }
+                        default: // OP_RUN, biased by 1.
+                            iRun_ = b1 & 0x3f;
+                            break;
+                    }
+                }
+                index_[hash(px)] = px;
+            }
+
+            d[0] = px.r;
+            d[1] = px.g;
+            d[2] = px.b;
+            d[3] = px.a;
+            d += 4;
+        }
+
+        pIn_ = p;
+        px_ = px;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef READAHEAD_HPP
+#define READAHEAD_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+/* Read-ahead cache in front of a slow file (the SD card). `read()` serves from `Chunks` aligned buffers of `ChunkSize` bytes, and `prefetch()` fills the chunk after the one being read, so call it whenever there's idle time. A read that finds nothing buffered has to wait on the file; that's a stall. `File` needs `seekSet(position)` and `read(buffer, length)`. Offsets are absolute file offsets, and chunks start on multiples of `ChunkSize` so every fill is whole sectors. */
+template <typename File, int ChunkSize = 16384, int Chunks = 2>
+struct ReadAhead {
+    uint8_t  chunks[Chunks][ChunkSize] __attribute__((aligned(32)));
+    uint32_t chunkStart[Chunks];
+    int32_t  chunkLen[Chunks]; // `0` if empty.
+    File*    file;   // What the chunks were read from.
+    uint32_t pos;    // Next byte `read()` returns.
+    uint32_t end;    // `read()` stops here.
+    uint32_t stalls; // Reads that had to wait on the file.
+    uint32_t hits;   // Reads served entirely from chunks.
+
+    /* Forgets every chunk. Call when `file` gets reopened as a different file. */
+    void invalidate() {
+        memset(chunkLen, 0, sizeof(chunkLen));
+    }
+
+    /* Points reads at `length` bytes of `f` from `start`. Chunks from the same `f` are kept. */
+    void attach(File* f, uint32_t start, uint32_t length) {
+        if (f != file) {
+            invalidate();
+            file = f;
+        }
+        pos = start;
+        end = start + length;
+    }
+
+    void seek(uint32_t position) {
+        pos = position;
+    }
+
+    /* Chunk holding `position`, or `-1`. */
+    int find(uint32_t position) {
+        for (int i = 0; i < Chunks; i++) {
+            if (chunkLen[i] && position >= chunkStart[i] && position < chunkStart[i] + chunkLen[i]) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /* Reads the chunk starting at `start` into an empty chunk, else the oldest one `pos` isn't in. Returns it, or `-1` if there's no room or the file read failed. */
+    int fill(uint32_t start) {
+        int current = find(pos);
+        int victim  = -1;
+        for (int i = 0; i < Chunks; i++) {
+            if (!chunkLen[i]) {
+                victim = i;
+                break;
+            }
+            if (i != current && (victim < 0 || chunkStart[i] < chunkStart[victim])) {
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return -1;
+        }
+
+        chunkLen[victim] = 0;
+        if (!file->seekSet(start)) {
+            return -1;
+        }
+        int32_t got = file->read(chunks[victim], ChunkSize);
+        if (got <= 0) {
+            return -1;
+        }
+        chunkStart[victim] = start;
+        chunkLen[victim] = got;
+        return victim;
+    }
+
+    int32_t read(uint8_t* buffer, int32_t length) {
+        bool    stalled = false;
+        int32_t done = 0;
+
+        if (length > (int32_t)(end - pos)) {
+            length = (pos < end) ? end - pos : 0;
+        }
+        while (done < length) {
+            int i = find(pos);
+            if (i < 0) {
+                stalled = true;
+                i = fill(pos - pos % ChunkSize);
+                if (i < 0 || find(pos) != i) {
+                    break; // Past the end of the file.
+                }
+            }
+
+            int32_t n = chunkStart[i] + chunkLen[i] - pos;
+            n = (n < length - done) ? n : length - done;
+            memcpy(&buffer[done], &chunks[i][pos - chunkStart[i]], n);
+            done += n;
+            pos  += n;
+        }
+
+        stalls += stalled;
+        hits   += !stalled && done;
+        return done;
+    }
+
+    /* Fills the chunk `read()` needs next, if it isn't already. Returns whether it read anything. */
+    bool prefetch() {
+        if (!file || pos >= end) {
+            return false;
+        }
+
+        uint32_t next = pos - pos % ChunkSize;
+        if (find(pos) >= 0) {
+            next += ChunkSize; // Current chunk's there, so get the one after.
+        }
+        if (next >= end || find(next) >= 0) {
+            return false;
+        }
+        return fill(next) >= 0;
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef SPAN_HPP
+#define SPAN_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include "blend.hpp"
+
+/* Span writes into a plain row-major `width` x `height` frame, like SmartMatrix's background back buffer at `rotation0`. Runs are clipped once up front, never per pixel. `Pixel` is 3 bytes of RGB (`rgb24`). */
+
+/* Sets `count` pixels at `pixels` to `color`. */
+template <typename Pixel>
+inline void fillSpan(Pixel* pixels, int count, Pixel color) {
+    for (int i = 0; i < count; i++) {
+        pixels[i] = color;
+    }
+}
+
+/* Blends a run of `count` premultiplied pixels, with their `alpha`, into row `y` of `frame` at `x` by `Blend`. Off-frame pixels are dropped. */
+template <int Blend, typename Pixel>
+inline void blendSpan(Pixel* frame, int width, int height, int x, int y, const Pixel* pixels, const uint8_t* alpha, int count, uint8_t opacity) {
+    if (y < 0 || y >= height) {
+        return;
+    }
+    if (x < 0) { // Clip left.
+        pixels -= x;
+        alpha  -= x;
+        count  += x;
+        x = 0;
+    }
+    if (x + count > width) { // Clip right.
+        count = width - x;
+    }
+    if (count > 0) {
+        blendRow<Blend>((uint8_t*)&frame[y*width + x], (const uint8_t*)pixels, alpha, count, opacity);
+    }
+}
+
+/* Shifts a `width`-pixel `row` right by `shift` (left if negative), filling the pixels it uncovers with `fill`. Shifts past `width` either way just fill the row. */
+template <typename Pixel>
+inline void shiftRow(Pixel* row, int width, int shift, Pixel fill) {
+    shift = (shift < -width) ? -width : (shift > width) ? width : shift;
+    if (shift > 0) { // Right.
+        memmove(&row[shift], row, (width - shift)*sizeof(Pixel));
+        fillSpan(row, shift, fill);
+    } else if (shift < 0) { // Left.
+        memmove(row, &row[-shift], (width + shift)*sizeof(Pixel));
+        fillSpan(&row[width + shift], -shift, fill);
+    }
+}
+
+#endif
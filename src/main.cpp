@@ -5,9 +5,6 @@
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 #define CLAMP(x, min, max) (MIN(MAX(x, min), max))
-#define RAND_SIGN() (random(2) == 0 ? -1 : 1) 
-#define RAND_WEIGHTED(magnitude) (int)(sqrt(random((int)pow((float)magnitude, 2.0)))) // Weighs the random towards 0.
-#define CHANCE(chance) ((chance == 0.0f) ? false : random(100) < chance*100) // Checks if the chance passes.
 
 /* --- --- --- --- SmartMatrix Defs --- --- --- --- */
 
@@ -46,7 +43,14 @@ SMARTMATRIX_ALLOCATE_INDEXED_LAYER(indexedLayer, kMatrixWidth, kMatrixHeight, CO
 #include "hardcoded_images/test_card.h"
 
 #include "include/hsv.hpp"
+#include "include/bloom.hpp"
+#include "include/colorcache.hpp"
+#include "include/blend.hpp"
+#include "include/span.hpp"
+#include "include/glitchrand.hpp"
 #include "include/PNGdec/PNGdec.h"
+#include "include/qoi.hpp"
+#include "include/framecache.hpp"
 
 #define DrawArgs_DEFAULT N::DRAW::_DrawARGS_DEFAULT // This is literally just for the colors.
 
@@ -55,6 +59,9 @@ SMARTMATRIX_ALLOCATE_INDEXED_LAYER(indexedLayer, kMatrixWidth, kMatrixHeight, CO
 #include <SD.h>
 #include <cstring>
 
+#include "include/readahead.hpp"
+#include "include/frametable.hpp"
+
 /* --- --- --- --- LCD Defs --- --- --- --- */
 
 #include <LCD_I2C.h>
@@ -132,9 +139,18 @@ namespace N {
         }
     };
     namespace DRAW { // Drawing. 
-        PNG png;
+        PNG<64, 4, 15> png; // Sized for the panel: 64 RGBA pixels per line, ~3 KB less than `PNG<>`. Keeps zlib's full 32 KB window: a 64x64 RGBA PNG inflates to 16448 bytes, so a 16 KB window can't hold every match an encoder may emit.
+        QOI<64> qoi; // Frames stored as QOI instead, told apart by magic. Rows come out as RGBA `PNGDRAW`s, so `cacheLineCallback` takes both.
+        PNGTABLES pngTables[8]; // Huffman tables of the last few PNGs `png` decoded (~4 KB each), so looping animation frames skip rebuilding them. Set up in `setup()`.
         
-        float bloomScale = 0.0; // `0.0` represents whatever the PNG actually has from asprite blurring. `1.0` maxes every transparent pixel fully opaque.
+        float   bloomScale = 0.0; // `0.0` represents whatever the PNG actually has from asprite blurring. `1.0` maxes every transparent pixel fully opaque. Change it with `setBloomScale()`.
+        uint8_t bloomTable[256]; // `x + (255 - x)*bloomScale` for every `x`. V and S bloom by the same formula, so they share it.
+
+        /* Sets `bloomScale` and rebuilds `bloomTable`. The float math runs once per value here instead of twice per pixel. */
+        void setBloomScale(float scale) {
+            bloomScale = scale;
+            buildBloomTable(bloomTable, scale);
+        }
         
         uint32_t frameMillisPer = 1000/24;
         uint32_t frameMillisLastAt;
@@ -146,21 +162,22 @@ namespace N {
             float chance;
             int   magnitude;
 
-            inline bool happens() {
-                return ((enabled) ? CHANCE(chance) : false);
+            /* `glitchRandom.next()` below this means it happens. */
+            inline uint32_t threshold() const {
+                return (enabled) ? Xoshiro128::threshold(chance) : 0;
             }
         };        
 
-        typedef struct DrawArgs { // TODO: Figure out color mixing.
+        typedef struct DrawArgs {
             int xOffset;
             int yOffset;
 
-            float* bloomScale;
+            const uint8_t* bloomTable;
             bool*  debug;
-            bool   mixBlack; // If `false`, treats all non-trans pixels as *fully* opaque. If `true`, mixes with black. Combine with `doBlack` to control behavior.
-            bool   drawBlack; // Whether to draw black pixels. Saves cycles sometimes when combined iwth `mixBlack=true`.
+            uint8_t    opacity; // `255` draws the layer as decoded, `0` hides it.
+            BlendModes blend; // How the layer combines with the ones under it. See `compose()`.
             
-            struct Glitches { // TODO: Make the "looks nice" values defaults for glitches being on/off.
+            struct Glitches { // Run over the whole frame by `postProcess()`, not per layer. TODO: Make the "looks nice" values defaults for glitches being on/off.
                 Glitch jitter; // Left-right jitter. `{. chance = 0.02f, .magnitude = 3 }` looks nice. 
                 Glitch chromatic; // Color alteration. `{ .chance = 0.02f, .magnitude = 80 }` loks nice.
                 Glitch desaturate; // Desaturation. `{ .chance = 0.02f, .magnitude = 80 }` looks nice.
@@ -169,99 +186,354 @@ namespace N {
         } PRIVATE; // `PRIVATE` needed for `PNGdec::PNGDraw`.
 
         static const DrawArgs _DrawARGS_DEFAULT = {    
-            .bloomScale = &N::DRAW::bloomScale,
+            .bloomTable = N::DRAW::bloomTable,
             .debug = &N::debug,
-            .mixBlack = true,
-            .drawBlack = false,
+            .opacity = 255,
+            .blend = BLEND_OVER,
         };
     
-        /* Draws one line. `<PNGdec>` calls this for each line in the PNG on `png.decode()`. */
-        void drawLineCallback(PNGDRAW *pDraw) {
-            PRIVATE *pPriv = (PRIVATE *)pDraw->pUser; // IDK if I can change these names? Cpp is weird. 
-            uint16_t pixelsRow[64]; // image width is *always* 64.
-            uint8_t  pixelsOpaque[8];
-        
-            /* Fetch line information. */
-            png.getLineAsRGB565(pDraw, pixelsRow, PNG_RGB565_LITTLE_ENDIAN, (pPriv->mixBlack) ? 0x00000000 : 0xFFFFFFFF); // With 0xFFFFFFFF, all non-zero transparencies of a given color are that color, and `png.getAlphaMask(...)` works. With 0x00000000, every pixel gets mixed with black to include transparency as a color modifier (such as in dimmed bloom pixels). Might want to pass in a `doTransparency` arg via the `PRIVATE` struct to only selectively use this behavior. Drawing on top of without entirely erasing the scene isn't possible with 0x00000000.
-            if (!png.getAlphaMask(pDraw, pixelsOpaque, 0)) { // Color mixing can turn transparency into black, which counts as non-opaque!
-                return; // Skip row if no pixels.
+        /* Packs a line's 8-byte opacity mask so pixel 0 is the top bit, ready for count-leading-zero scans. */
+        inline uint64_t maskBits(const uint8_t *pixelsOpaque) {
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; i++) {
+                bits = (bits << 8) | pixelsOpaque[i];
             }
-    
-            /* Draw line. */
-            int16_t glitchJitterX    = pPriv->glitches.jitter.happens() ? RAND_SIGN() * RAND_WEIGHTED(pPriv->glitches.jitter.magnitude) : 0;
-            int16_t glitchDesaturate = pPriv->glitches.desaturate.happens() ? RAND_WEIGHTED(pPriv->glitches.desaturate.magnitude) : 0;
-            int16_t glitchChromatic  = pPriv->glitches.chromatic.happens() ? RAND_SIGN() * RAND_WEIGHTED(pPriv->glitches.chromatic.magnitude) : 0;
-            bool    glitchFailDraw   = pPriv->glitches.fail.happens();
-    
-            if (glitchFailDraw) {
+            return bits;
+        }
+
+        /* Runs bloom over the palette entries flagged in `used` (all of them if `NULL`). */
+        void effectPalette(PRIVATE *pPriv, const rgb24 *palette, const uint8_t *used, int count, rgb24 *effected) {
+            for (int i = 0; i < count; i++) {
+                if (!used || used[i]) {
+                    effectRow(&palette[i], &effected[i], 1, pPriv->bloomTable);
+                }
+            }
+        }
+
+        ColorCache<rgb24> effectCache; // `effectRow` remembered per color for `effectCacheBloom`. ~7 KB.
+        uint8_t           effectCacheBloom[256]; // The `bloomTable` contents `effectCache` holds results for.
+        bool              effectCacheValid;
+
+        /* Empties `effectCache` if `bloomTable` isn't what it holds results for. Call once per frame. Any per-frame color effect added to `effectRow` just needs its settings in this check. */
+        void updateEffectCache(const uint8_t *bloomTable) {
+            if (effectCacheValid && memcmp(effectCacheBloom, bloomTable, sizeof(effectCacheBloom)) == 0) {
                 return;
             }
+            effectCache.clear();
+            memcpy(effectCacheBloom, bloomTable, sizeof(effectCacheBloom));
+            effectCacheValid = true;
+        }
+
+        /* Whether `args` changes pixel colors as they're drawn. Bloom is off when the table is the identity, which `bloomTable[0] == 0` implies. */
+        inline bool hasEffects(const PRIVATE *pPriv) {
+            return pPriv->bloomTable[0] != 0;
+        }
+
+        struct Layer { // A `FrameCache` queued by `addLayer()` for `compose()`, with how to draw it.
+            DrawArgs    args;
+            FrameCache* pCache;
+            void      (*drawLine)(const Layer *pLayer, int16_t y); // From `drawLineFor()`.
+            bool        paletted; // Bloom comes from `paletteEffected` by index.
+            bool        cached; // Bloom goes through `effectCache`. Only layers with the bloom it holds; the rest run `effectRow` directly.
+            rgb24       paletteEffected[256];
+        };
+
+        Layer layers[4]; // This frame's layers, bottom first. ~3.3 KB.
+        int   layerCount;
+
+        /* Blends row `y` of a layer into the frame, offset by its `DrawArgs`. Fully transparent spans are skipped; every mode leaves those pixels alone. With `Effects`, colors are bloomed by index for indexed images, else through `effectCache` (`compose()` keeps it current), and alpha is bloomed by the same table, so a fully bloomed layer is fully opaque. Specialised on the blend mode and effects so neither is tested per pixel; get one from `drawLineFor()`. */
+        template <int Blend, bool Effects> // `Effects` is bloom; without it pixels are blended straight from the cache.
+        void drawLine(const Layer *pLayer, int16_t y) {
+            const FrameCache *pCache = pLayer->pCache;
+            const DrawArgs   *pArgs = &pLayer->args;
+            int16_t modY = y + pArgs->yOffset;
+            if (!(pCache->rowOpacity[y] & PNG_MASK_ANY_OPAQUE) || modY < 0 || modY >= kMatrixHeight) {
+                return;
+            }
+
+            rgb24   effected[64];
+            uint8_t alphaEffected[64];
     
-            for (size_t x = 0; x < 64; x++) {
-                if (!pPriv->mixBlack && !((pixelsOpaque[x/8] >> (7 - x%8)) & 1)) {
-                    continue; // Skip pixel if we're drawing transparency and this pixel is transparent.
-                }
-    
-                if (!pPriv->drawBlack && !pixelsRow[x]) {
-                    continue; // Skip pixel if we're not drawing black and this pixel is black.
+            uint64_t drawBits = maskBits(pCache->opaque[y]);
+            while (drawBits) {
+                int x   = __builtin_clzll(drawBits); // Jump over the transparent span.
+                int end = (~(drawBits << x)) ? x + __builtin_clzll(~(drawBits << x)) : 64; // End of this drawn span.
+                drawBits &= (end < 64) ? (~0ULL >> end) : 0;
+
+                const rgb24   *span = &pCache->pixels[y][x];
+                const uint8_t *spanAlpha = &pCache->alpha[y][x];
+                if (Effects) {
+                    const uint8_t *bloomTable = pArgs->bloomTable;
+                    if (pLayer->paletted) {
+                        for (int i = x; i < end; i++) {
+                            effected[i] = pLayer->paletteEffected[pCache->indexes[y][i]];
+                        }
+                    } else if (pLayer->cached) {
+                        effectCache.apply(span, &effected[x], end - x, [bloomTable](const rgb24 *in, rgb24 *out, int count) { effectRow(in, out, count, bloomTable); });
+                    } else {
+                        effectRow(span, &effected[x], end - x, bloomTable);
+                    }
+                    for (int i = x; i < end; i++) {
+                        alphaEffected[i] = bloomTable[pCache->alpha[y][i]];
+                    }
+                    span = &effected[x];
+                    spanAlpha = &alphaEffected[x];
                 }
-    
-                /* Recompose as rgb24. */
-                uint16_t rgb565pixel = pixelsRow[x];
-    
-                uint8_t blue =  ( rgb565pixel        & 0x1F) << 3;
-                uint8_t green = ((rgb565pixel >> 5)  & 0x3F) << 2;
-                uint8_t red =   ((rgb565pixel >> 11) & 0x1F) << 3;
-        
-                rgb24 rgb24pixel = rgb24(red, green, blue);
-                hsv24 hsv24pixel = rgbToHsv(rgb24pixel);
-    
-                hsv24pixel.h = (hsv24pixel.h + glitchChromatic) % 255; // Intentional rollover!
-                hsv24pixel.v = hsv24pixel.v + (255 - hsv24pixel.v)*(*pPriv->bloomScale);
-                hsv24pixel.s = hsv24pixel.s + (255 - hsv24pixel.s)*(*pPriv->bloomScale);
-                hsv24pixel.s = hsv24pixel.s - MIN(glitchDesaturate, 255 - hsv24pixel.v);
-    
-                rgb24pixel = hsvToRgb(hsv24pixel);
-        
+
                 /* Draw. */
-                int16_t modX =        x + pPriv->xOffset + glitchJitterX; 
-                int16_t modY = pDraw->y + pPriv->yOffset;
-                modX = CLAMP(modX, 0, 63);
-                modY = CLAMP(modY, 0, 63);
-    
-                backgroundLayer.drawPixel((int16_t)modX, (int16_t)modY, rgb24pixel);   
+                blendSpan<Blend>(backgroundLayer.backBuffer(), kMatrixWidth, kMatrixHeight, x + pArgs->xOffset, modY, span, spanAlpha, end - x, pArgs->opacity); // Rotation is the default `rotation0`, so the buffer is plain row-major.
             }
         }
+
+        typedef void (*DrawLineFunc)(const Layer *pLayer, int16_t y);
+
+        /* Picks the `drawLine` specialisation for `args`. Call once per layer, not per line. */
+        DrawLineFunc drawLineFor(const PRIVATE *pPriv) {
+            static const DrawLineFunc kernels[BLEND_MODES][2] = { // [blend][effects]
+                { drawLine<BLEND_OVER,   false>, drawLine<BLEND_OVER,   true> },
+                { drawLine<BLEND_ADD,    false>, drawLine<BLEND_ADD,    true> },
+                { drawLine<BLEND_SCREEN, false>, drawLine<BLEND_SCREEN, true> },
+            };
+            return kernels[pPriv->blend][hasEffects(pPriv)];
+        }
+
+        FrameCache frameCaches[2]; // One per hardcoded still image. Bump if more get added.
+        int        frameCacheNextEvict;
+        void*      decoderOwner; // Whoever has a `decodeLines()` decode suspended in `png` or `qoi`. They share `SDC`'s file, so anyone else using either clears this, which tells the owner to start over.
+
+        /* Stores one converted line in the `FrameCache` passed as the user pointer. */
+        void cacheLineCallback(PNGDRAW *pDraw) {
+            cacheLine(png, pDraw, (FrameCache *)pDraw->pUser);
+        }
+
+        /* Finds the cached decode of `png_data`, decoding it on first use. Returns `NULL` if it failed to decode, then or on first use. */
+        FrameCache* cacheFor(const uint8_t* png_data, int png_data_len) {
+            FrameCache *pCache = NULL;
+
+            for (size_t i = 0; i < sizeof(frameCaches)/sizeof(frameCaches[0]); i++) {
+                if (frameCaches[i].source == png_data) {
+                    return (frameCaches[i].failed) ? NULL : &frameCaches[i]; // Hit.
+                }
+
+                if (!pCache && !frameCaches[i].source) {
+                    pCache = &frameCaches[i]; // First free slot.
+                }
+            }
+
+            if (!pCache) { // All full, so evict round-robin.
+                pCache = &frameCaches[frameCacheNextEvict];
+                frameCacheNextEvict = (frameCacheNextEvict + 1) % (sizeof(frameCaches)/sizeof(frameCaches[0]));
+            }
+
+            clearCache(pCache);
+
+            decoderOwner = NULL; // Takes `png` from any suspended decode.
+            png.close();
+            png.openRAM((uint8_t *)png_data, png_data_len, cacheLineCallback);
+            pCache->source = png_data;
+            if (png.decode((void *)pCache, 0) != PNG_SUCCESS) {
+                pCache->failed = true; // Remembered, so a bad image isn't re-decoded every frame.
+                return NULL;
+            }
+            return pCache;
+        }
         
-        /* Draw PNG from RAM. */
+        /* Queues a decoded `FrameCache` as the next layer up, drawn with `args`' blend, opacity and effects by `compose()`. It's read then, so it has to stay put until the frame's drawn. Layers past `layers`' size are dropped. */
+        void addLayer(DrawArgs args, FrameCache *pCache) {
+            if (layerCount == sizeof(layers)/sizeof(layers[0])) {
+                return;
+            }
+
+            Layer *pLayer = &layers[layerCount++];
+            pLayer->args = args;
+            pLayer->pCache = pCache;
+            pLayer->drawLine = drawLineFor(&args);
+            pLayer->paletted = pCache->paletteCount && hasEffects(&args);
+            if (pLayer->paletted) {
+                effectPalette(&args, pCache->palette, pCache->paletteUsed, pCache->paletteCount, pLayer->paletteEffected); // Once per frame, not per pixel.
+            }
+        }
+
+        /* Blends every queued layer into the background layer's back buffer, bottom up, all layers a row at a time, then empties the queue. Call once per frame, after the last `addLayer()` and before `postProcess()`. */
+        void compose() {
+            bool effectCacheSet = false;
+            for (int i = 0; i < layerCount; i++) {
+                Layer *pLayer = &layers[i];
+                if (!hasEffects(&pLayer->args) || pLayer->paletted) {
+                    continue;
+                }
+                if (!effectCacheSet) {
+                    updateEffectCache(pLayer->args.bloomTable); // The first bloomed layer's; layers usually share `N::DRAW::bloomTable`.
+                    effectCacheSet = true;
+                }
+                pLayer->cached = memcmp(effectCacheBloom, pLayer->args.bloomTable, sizeof(effectCacheBloom)) == 0;
+            }
+
+            for (int16_t y = 0; y < 64; y++) {
+                for (int i = 0; i < layerCount; i++) {
+                    layers[i].drawLine(&layers[i], y);
+                }
+            }
+            layerCount = 0;
+        }
+
+        /* Draw PNG from RAM. Decodes once into a `FrameCache`, then every later call only queues it as a layer. */
         inline void drawFromRAM(DrawArgs args, uint8_t* png_data, int png_data_len) {
-            png.close();
-            png.openRAM(png_data, png_data_len, drawLineCallback);
-            png.decode((void *)&args, 0);
+            FrameCache *pCache = cacheFor(png_data, png_data_len);
+            if (pCache) {
+                addLayer(args, pCache);
+            }
+        }
+
+        /* Hue-shifts and desaturates `count` (up to 64) already-drawn pixels in place. */
+        inline void glitchColorRow(rgb24 *pixels, int count, int16_t glitchChromatic, int16_t glitchDesaturate) {
+            hsv24 hsv[64];
+
+            rgbToHsvRow(pixels, hsv, count);
+            for (int i = 0; i < count; i++) {
+                hsv[i].h = (hsv[i].h + glitchChromatic) % 255; // Intentional rollover!
+                hsv[i].s = hsv[i].s - MIN(glitchDesaturate, 255 - hsv[i].v);
+            }
+            hsvToRgbRow(hsv, pixels, count);
+        }
+
+        Xoshiro128       glitchRandom; // Every glitch roll. Seeded from `glitchSeed` in `setup()`.
+        uint32_t         glitchSeed = 1; // Same seed, same glitches, every run and on a host.
+        WeightedTable<>  glitchWeights[4]; // Magnitude distributions in use, 1 KB each. `weightsFor()` builds them.
+        int              glitchWeightsNextEvict;
+
+        /* The weighted distribution for `magnitude`, built on first use. */
+        const WeightedTable<>* weightsFor(int magnitude) {
+            for (size_t i = 0; i < sizeof(glitchWeights)/sizeof(glitchWeights[0]); i++) {
+                if (glitchWeights[i].magnitude == magnitude) {
+                    return &glitchWeights[i];
+                }
+            }
+
+            WeightedTable<> *pWeights = &glitchWeights[glitchWeightsNextEvict];
+            glitchWeightsNextEvict = (glitchWeightsNextEvict + 1) % (sizeof(glitchWeights)/sizeof(glitchWeights[0]));
+            pWeights->build(magnitude);
+            return pWeights;
+        }
+
+        struct RowGlitches { // One row's rolls.
+            int16_t jitterX;
+            int16_t desaturate;
+            int16_t chromatic;
+            bool    fail;
+        };
+
+        /* Rolls every row's glitches for a frame in one batch: thresholds and distributions are looked up once, then each roll is a `glitchRandom` draw and a table lookup. Glitches that can't happen draw nothing. Returns `false`, leaving `rows` unset, if none can. */
+        bool rollGlitches(DrawArgs::Glitches glitches, RowGlitches *rows, int count) {
+            uint32_t jitterAt = glitches.jitter.threshold(), desaturateAt = glitches.desaturate.threshold(), chromaticAt = glitches.chromatic.threshold(), failAt = glitches.fail.threshold();
+            if (!(jitterAt | desaturateAt | chromaticAt | failAt)) {
+                return false;
+            }
+            const WeightedTable<> *jitterWeights     = (jitterAt) ? weightsFor(glitches.jitter.magnitude) : NULL;
+            const WeightedTable<> *desaturateWeights = (desaturateAt) ? weightsFor(glitches.desaturate.magnitude) : NULL;
+            const WeightedTable<> *chromaticWeights  = (chromaticAt) ? weightsFor(glitches.chromatic.magnitude) : NULL;
+
+            for (int y = 0; y < count; y++) { // One draw per statement, sign before magnitude: C++ leaves the order of calls within an expression open, and the order is the sequence.
+                rows[y].jitterX = rows[y].desaturate = rows[y].chromatic = 0;
+                if (jitterAt && glitchRandom.next() < jitterAt) {
+                    int sign = glitchRandom.sign();
+                    rows[y].jitterX = sign * jitterWeights->draw(glitchRandom.next());
+                }
+                if (desaturateAt && glitchRandom.next() < desaturateAt) {
+                    rows[y].desaturate = desaturateWeights->draw(glitchRandom.next());
+                }
+                if (chromaticAt && glitchRandom.next() < chromaticAt) {
+                    int sign = glitchRandom.sign();
+                    rows[y].chromatic = sign * chromaticWeights->draw(glitchRandom.next());
+                }
+                rows[y].fail = failAt && glitchRandom.next() < failAt;
+            }
+            return true;
+        }
+
+        /* Glitches the composed frame in the background layer's back buffer, rolling each stage per row: drop (`fail`), hue shift (`chromatic`) and `desaturate`, then shift (`jitter`). Dropped and shifted-in pixels get `defaultBackgroundColor`. Call once per frame, after every layer is drawn. */
+        void postProcess(DrawArgs::Glitches glitches) {
+            rgb24       *frame = backgroundLayer.backBuffer(); // Plain row-major, same as `blendSpan` writes.
+            RowGlitches  rolls[kMatrixHeight];
+            if (!rollGlitches(glitches, rolls, kMatrixHeight)) {
+                return; // Every mode but `NCFG_M_KNOCKEDTFOUT` has them all off.
+            }
+
+            for (int y = 0; y < kMatrixHeight; y++) {
+                int16_t glitchJitterX    = rolls[y].jitterX;
+                int16_t glitchDesaturate = rolls[y].desaturate;
+                int16_t glitchChromatic  = rolls[y].chromatic;
+                bool    glitchFailDraw   = rolls[y].fail;
+                rgb24  *row = &frame[y*kMatrixWidth];
+
+                if (glitchFailDraw) {
+                    fillSpan(row, kMatrixWidth, defaultBackgroundColor);
+                    continue;
+                }
+
+                if (glitchChromatic || glitchDesaturate) {
+                    glitchColorRow(row, kMatrixWidth, glitchChromatic, glitchDesaturate);
+                }
+
+                shiftRow(row, kMatrixWidth, glitchJitterX, defaultBackgroundColor);
+            }
         }
     };
     namespace SDC  { // SD Card. 
-        File sdFile;
+        typedef FrameSource<FsFile, SdCard> Source;
+
+        FsFile   sdFile;
+        Source   sdSource = { &sdFile }; // `sdFile`, or a contiguous frame file read by sector.
+        Source*  source = &sdSource; // What `read`/`seek` use: `sdSource`, or a kept-open animation pack's.
+        uint32_t fileBase; // Where the image starts in `*source`. Only non-zero inside a pack.
+        uint32_t fileLen;  // Image length, so reads inside a pack stop at the frame's end.
+
+        ReadAhead<Source> readAhead; // All PNG reads go through this. Two 16 KB chunks instead of PNGdec's 2 KB reads.
     
         void* open(const char* filename, int32_t* size) {
             Serial.printf("Opening file \"%s\".\n", filename);
             
-            sdFile = SD.open(filename);
-            *size = sdFile.size();
+            sdFile = SD.sdfs.open(filename, O_RDONLY);
+            sdSource.file = &sdFile;
+            sdSource.bySector = false;
+            source = &sdSource;
+            fileBase = 0;
+            *size = fileLen = sdFile.fileSize();
+            readAhead.invalidate(); // Same handle, different file.
+            readAhead.attach(source, fileBase, fileLen);
         
-            return &sdFile;
+            return &sdSource;
+        }
+
+        /* Like `open`, but for an image at `fileBase` inside the already-open `source` (a pack, or a frame `FrameTable::open` pointed `sdSource` at). Set all three before `png.open()`. `filename` is unused. */
+        void* openPacked(const char* filename, int32_t* size) {
+            if (!*source) {
+                return NULL;
+            }
+            *size = fileLen;
+            readAhead.attach(source, fileBase, fileLen); // Keeps chunks already read from this pack, like the end of the last frame.
+
+            return source;
         }
     
         void close(void* handle) {
-            if (sdFile) { sdFile.close(); }
+            if (handle == &sdSource && sdFile) { sdFile.close(); } // Packs stay open, and sector reads have nothing to close.
         }
     
         int32_t read(PNGFILE* handle, uint8_t* buffer, int32_t length) {
-            return (sdFile) ? sdFile.read(buffer, length) : 0;
+            return (*source) ? readAhead.read(buffer, length) : 0;
         }
     
         int32_t seek(PNGFILE* handle, int32_t position) {
-            return (sdFile) ? sdFile.seek(position) : 0;
+            readAhead.seek(fileBase + position);
+            return position;
+        }
+
+        /* Reads ahead of the decoder. Call when there's time to spare; a read that finds its data already here doesn't wait on the card. */
+        void prefetch() {
+            if (*source) {
+                readAhead.prefetch();
+            }
         }
     };
     namespace LCD  { // LCD Screen. 
@@ -319,58 +591,250 @@ namespace N {
         }
     };
     namespace ANIM { // Animations. 
+        enum packFormats { // How a frame in an animation pack is stored.
+            PACK_FRAME_FILE,  // A whole PNG or QOI file, told apart by magic.
+            PACK_FRAME_RGB24, // 64x64 raw `rgb24`, row-major. No alpha.
+        };
+
+        struct PackHeader { // Start of `animations/{name}.anim`. See `tools/pack_anim.py`. Little-endian.
+            char     magic[4]; // "NANM"
+            uint16_t version;  // 1
+            uint16_t frameCount;
+            uint16_t width;
+            uint16_t height;
+        };
+
+        struct PackFrame { // Follows `PackHeader`, one per frame.
+            uint32_t offset; // From the start of the file.
+            uint32_t size;
+            uint16_t durationMillis; // `0` advances every drawn frame.
+            uint8_t  format; // `packFormats`.
+            uint8_t  reserved;
+        };
+        static_assert(sizeof(PackHeader) == 12 && sizeof(PackFrame) == 12, "Pack structs must match `tools/pack_anim.py`.");
+
         typedef struct Animation {
-            char name[32] = {0}; // Used to search file structure, so be consistent.
-            char folderPath[128] = {0}; // animations/{name}/
-            char basePath[12] = "animations/"; // Has the forward slash!
-            int  curFrame = 0;
+            static constexpr int maxFrames = 512;
+
+            char     name[32] = {0}; // Used to search file structure, so be consistent.
+            char     folderPath[128] = {0}; // animations/{name}/
+            char     basePath[12] = "animations/"; // Has the forward slash!
+            int      curFrame = 0;
+            int      frameCount = 0; // Frames `1..frameCount` all exist.
+            FrameTable<FsFile, SdCard, maxFrames> frames; // Where frame `n`'s file is, found once by `init`.
+            FsFile   dir; // Kept open so fragmented frames open by index.
+            FsFile    pack; // `animations/{name}.anim` if there is one, kept open. Preferred over `dir`.
+            N::SDC::Source packSource = { &pack }; // What `SDC` reads `pack` through.
+            PackFrame packFrames[maxFrames];
+            uint32_t  frameShownAt; // `millis()` the current frame was first drawn.
+
+            static constexpr int decodeLinesPerPoll = 8; // Lines loaded per `poll()`. Lower keeps `loop()` snappier, higher loads frames in fewer loops.
+
+            FrameCache  frameCaches[2];
+            FrameCache* shown   = NULL; // Last fully loaded frame, drawn on every `drawNextFrame`.
+            FrameCache* pending = &frameCaches[0]; // Next frame, loaded a few lines per `poll()`.
+            int         pendingFrame = 0; // Frame number loading into `pending`. `0` before the first `drawNextFrame`.
+            int         pendingLine; // Lines of `pending` loaded so far, for raw frames.
+            bool        pendingStarted; // Whether `pending`'s frame is open in `png` or `qoi`.
+            bool        pendingQOI; // Which of the two.
+            bool        pendingReady;
+
+            /* Opens `animations/{name}.anim` and reads its frame table. Returns `false` if there isn't a usable one. */
+            bool initPack() {
+                char packPath[128] = {0};
+                strcpy(packPath, basePath);
+                strcat(packPath, name);
+                strcat(packPath, ".anim"); // animations/{name}.anim
+
+                pack = SD.sdfs.open(packPath, O_RDONLY);
+                if (!pack) {
+                    return false;
+                }
+
+                PackHeader header;
+                bool       ok = (
+                    pack.read(&header, sizeof(header)) == sizeof(header) &&
+                    memcmp(header.magic, "NANM", 4) == 0 && header.version == 1 && header.frameCount >= 1 && header.frameCount <= maxFrames &&
+                    header.width == kMatrixWidth && header.height == kMatrixHeight && // Frames load into panel-sized `FrameCache`s.
+                    pack.read(packFrames, header.frameCount*sizeof(PackFrame)) == (int)(header.frameCount*sizeof(PackFrame))
+                );
+                for (int i = 0; ok && i < header.frameCount; i++) { // Every frame has to be inside the file, and raw ones exactly a `FrameCache`'s pixels.
+                    PackFrame *frame = &packFrames[i];
+                    ok = (uint64_t)frame->offset + frame->size <= pack.fileSize() &&
+                        (frame->format == PACK_FRAME_FILE || (frame->format == PACK_FRAME_RGB24 && frame->size == sizeof(FrameCache::pixels)));
+                }
+                if (!ok) {
+                    Serial.printf("Bad animation pack \"%s\". Falling back to frame files.\n", packPath);
+                    pack.close();
+                    return false;
+                }
+
+                frameCount = header.frameCount;
+                return true;
+            }
         
+            /* Opens the animation's pack, or else scans `animations/{name}/` once for `{name}{n}.png` or `{name}{n}.qoi` frames. */
             void init(const char* animName) {
                 strcpy(name, animName);
         
                 strcpy(folderPath, basePath);
                 strcat(folderPath, animName);
                 strcat(folderPath, "/"); // animations/{name}/
+
+                frameCount = 0;
+
+                if (initPack()) {
+                    return;
+                }
+
+                dir = SD.sdfs.open(folderPath, O_RDONLY);
+                if (dir) {
+                    frameCount = frames.scan(&dir, name);
+                }
             }
         
-            void drawNextFrame(N::DRAW::PRIVATE args) {
-                /* Create path of next-to-be-drawn frame file. */
-                char framePath[128] = {0};
-                strcpy(framePath, folderPath);
-                strcat(framePath, name); // animations/{anim}/{anim}
-        
-                curFrame++;
-                char frameNum[16] = {0};
-                itoa(curFrame, frameNum, 10);
-                strcat(framePath, frameNum);
-                strcat(framePath, ".png"); // animations/{anim}/{anim}{frameNum}.png
-        
-                /* Revert back to frame #1 if at the end of the animation. */
-                if (!SD.exists(framePath)) {
-                    if (args.debug) {
-                        Serial.printf("No \"%s\". Rewinding animation \"%s\".\n", framePath, folderPath);
+            /* Starts loading frame `frameNum` into `pending`. `poll()` does the work. */
+            void request(int frameNum) {
+                clearCache(pending);
+                pendingFrame = frameNum;
+                pendingLine = 0;
+                pendingStarted = false;
+                pendingReady = false;
+            }
+
+            /* Opens `pendingFrame` in the shared `qoi` or `png`, by its magic, converting into `pending`. Returns `false` if the frame file wouldn't open or is bigger than the panel. */
+            bool openPending() {
+                N::DRAW::png.close();
+                N::DRAW::qoi.close();
+
+                if (pack) { // From the pack.
+                    PackFrame *frame = &packFrames[pendingFrame - 1];
+                    N::SDC::source = &packSource;
+                    N::SDC::fileBase = frame->offset;
+                    N::SDC::fileLen = frame->size;
+                } else { // From the frame's file, by sector when it's contiguous. Opened here to check its magic, then reused like a pack frame.
+                    if (!frames.open(pendingFrame, &dir, &N::SDC::sdFile, SD.sdfs.card(), &N::SDC::sdSource)) {
+                        return false;
                     }
+                    N::SDC::source = &N::SDC::sdSource;
+                    N::SDC::fileBase = 0;
+                    N::SDC::fileLen = frames.frames[pendingFrame - 1].size;
+                    N::SDC::readAhead.invalidate(); // Same source, different file.
+                }
+
+                uint8_t magic[4] = {0};
+                N::SDC::readAhead.attach(N::SDC::source, N::SDC::fileBase, N::SDC::fileLen);
+                N::SDC::read(NULL, magic, sizeof(magic)); // Through `readAhead`, so it's the start of the chunk the decoder reads next.
+                pendingQOI = N::DRAW::qoi.isQOI(magic);
+
+                int width, height;
+                if (pendingQOI) {
+                    N::DRAW::qoi.open((const char*)name, N::SDC::openPacked, N::SDC::close, N::SDC::read, N::SDC::seek, N::DRAW::cacheLineCallback);
+                    width = N::DRAW::qoi.getWidth();
+                    height = N::DRAW::qoi.getHeight();
+                } else {
+                    N::DRAW::png.open((const char*)name, N::SDC::openPacked, N::SDC::close, N::SDC::read, N::SDC::seek, N::DRAW::cacheLineCallback);
+                    width = N::DRAW::png.getWidth();
+                    height = N::DRAW::png.getHeight();
+                }
+                if (width > kMatrixWidth || height > kMatrixHeight) { // Frames load into panel-sized `FrameCache`s, which don't clip.
+                    Serial.printf("Frame %d of \"%s\" is %dx%d, bigger than the panel. Skipping it.\n", pendingFrame, name, width, height);
+                    N::DRAW::png.close();
+                    N::DRAW::qoi.close();
+                    return false;
+                }
+                return true;
+            }
+
+            /* Loads a few more lines of the pending frame. Call every `loop()`; it never blocks for a whole frame. */
+            void poll() {
+                if (!pendingFrame || pendingReady) {
+                    return;
+                }
+
+                /* Raw frames are plain reads. */
+                if (pack && packFrames[pendingFrame - 1].format == PACK_FRAME_RGB24) {
+                    int lines = MIN(decodeLinesPerPoll, 64 - pendingLine);
+                    int bytes = lines*sizeof(pending->pixels[0]);
+                    if (!pack.seekSet(packFrames[pendingFrame - 1].offset + pendingLine*sizeof(pending->pixels[0])) || pack.read(pending->pixels[pendingLine], bytes) != bytes) {
+                        pendingReady = true; // Truncated pack. Show what loaded.
+                        return;
+                    }
+                    memset(pending->opaque[pendingLine], 0xFF, lines*sizeof(pending->opaque[0])); // No alpha, so every pixel is opaque.
+                    memset(pending->alpha[pendingLine], 0xFF, lines*sizeof(pending->alpha[0]));
+                    memset(&pending->rowOpacity[pendingLine], PNG_MASK_ANY_OPAQUE | PNG_MASK_ALL_OPAQUE, lines);
+                    pendingLine += lines;
+                    pendingReady = (pendingLine >= 64);
+                    return;
+                }
+
+                /* PNG and QOI frames share `png`, `qoi` and the SD file, so wait for whoever has them. If they got taken mid-decode, start over. */
+                if (pendingStarted && N::DRAW::decoderOwner != this) {
+                    clearCache(pending);
+                    pendingStarted = false;
+                }
+                if (!pendingStarted) {
+                    if (N::DRAW::decoderOwner) {
+                        return;
+                    }
+                    if (!openPending()) {
+                        pendingReady = true; // Missing frame. Shows as blank.
+                        return;
+                    }
+                    N::DRAW::decoderOwner = this;
+                    pendingStarted = true;
+                }
+
+                int result = (pendingQOI) ? N::DRAW::qoi.decodeLines((void *)pending, 0, decodeLinesPerPoll) : N::DRAW::png.decodeLines((void *)pending, 0, decodeLinesPerPoll);
+                if (result != PNG_DECODE_SUSPENDED) {
+                    N::DRAW::decoderOwner = NULL; // Done, or failed and draws what it got.
+                    pendingReady = true;
+                }
+            }
         
-                    memset(framePath, 0, sizeof(framePath));
-                    strcpy(framePath, folderPath);
-                    strcat(framePath, name); // /animations/{anim}/{anim}
-        
-                    curFrame = 1;
-                    char frameNum[16] = {0};
-                    itoa(curFrame, frameNum, 10);
-                    strcat(framePath, frameNum);
-                    strcat(framePath, ".png"); // /animations/{anim}/{anim}1.png
+            void drawNextFrame(N::DRAW::PRIVATE args) {
+                if (frameCount == 0) {
+                    return;
+                }
+
+                if (!pendingFrame) {
+                    request(1);
+                }
+
+                /* Show the pending frame once it's loaded and the current one's duration is up. Frame files have no durations, so they advance as fast as they load. */
+                uint32_t now = millis();
+                if (pendingReady && (!shown || !pack || now - frameShownAt >= packFrames[curFrame - 1].durationMillis)) {
+                    shown = pending;
+                    pending = (pending == &frameCaches[0]) ? &frameCaches[1] : &frameCaches[0];
+                    curFrame = pendingFrame;
+                    frameShownAt = now;
+
+                    /* Revert back to frame #1 if at the end of the animation. */
+                    int nextFrame = curFrame + 1;
+                    if (nextFrame > frameCount) {
+                        if (args.debug) {
+                            Serial.printf("No frame %d. Rewinding animation \"%s\". SD reads so far: %lu stalled, %lu read ahead.\n", nextFrame, folderPath, (unsigned long)N::SDC::readAhead.stalls, (unsigned long)N::SDC::readAhead.hits);
+                        }
+            
+                        nextFrame = 1;
+                    }
+                    request(nextFrame);
+                }
+
+                if (shown) {
+                    N::DRAW::addLayer(args, shown);
                 }
-                
-                /* Draw from frame file path. */
-                N::DRAW::png.close();
-                N::DRAW::png.open((const char*)framePath, N::SDC::open, N::SDC::close, N::SDC::read, N::SDC::seek, N::DRAW::drawLineCallback);
-                N::DRAW::png.decode((void *)&args, 0);
             }
         };
         
         Animation testSuite; // NOTE LOOKATME
         Animation testSpeed; // NOTE LOOKATME
+
+        /* Loads a slice of each animation's next frame. Call every `loop()`, not just on frame ticks. */
+        void poll() {
+            testSpeed.poll();
+            testSuite.poll();
+        }
     
     };
 };
@@ -414,10 +878,17 @@ void setup() {
     /* N Defaults */
     N::debug = false; // Overwride default debug state if needed (e.g. on new controller to get cmd#s).
     N::mode = N::modes::NCFG_M_KNOCKEDTFOUT;
+    N::DRAW::setBloomScale(N::DRAW::bloomScale); // Builds the bloom table.
+    N::DRAW::glitchRandom.seed(N::DRAW::glitchSeed);
+    N::DRAW::png.setTableCache(N::DRAW::pngTables, sizeof(N::DRAW::pngTables)/sizeof(N::DRAW::pngTables[0]));
 
     /* Animation Setup */
     N::ANIM::testSuite.init("test_suite");
     N::ANIM::testSpeed.init("test_speed");
+
+    /* Frame Cache Warmup */
+    N::DRAW::cacheFor(knockedtfout_png, (int)knockedtfout_png_len); // Decode the stills now so the first frame of each mode doesn't hitch.
+    N::DRAW::cacheFor(test_card_png, (int)test_card_png_len);
 }
 
 void loop() {
@@ -445,10 +916,10 @@ void loop() {
                     break;
                 /* NOTE all *cases* below this line to be refactored NOTE */
                 case N::IR::commands::bloomUp: 
-                    if (N::DRAW::bloomScale < 0.39) { N::DRAW::bloomScale += (bloomChanged =  0.05); }
+                    if (N::DRAW::bloomScale < bloomScaleMax) { N::DRAW::setBloomScale(N::DRAW::bloomScale + (bloomChanged =  bloomScaleStep)); }
                     break;
                 case N::IR::commands::bloomDown: 
-                    if (N::DRAW::bloomScale > 0.01) { N::DRAW::bloomScale += (bloomChanged = -0.05); }
+                    if (N::DRAW::bloomScale > bloomScaleMin) { N::DRAW::setBloomScale(N::DRAW::bloomScale + (bloomChanged = -bloomScaleStep)); }
                     break;
                 case N::IR::commands::next:
                     if (N::mode < N::modes::NCFG_M_MAX - 1) { N::mode += 1; }
@@ -471,6 +942,12 @@ void loop() {
         IrReceiver.resume();
     }
 
+    /* Animation loading, a few lines per loop so IR and the frame timer never wait on a whole decode. */
+    if (N::mode == N::modes::NCFG_M_TEST_ANIM) {
+        N::SDC::prefetch();
+        N::ANIM::poll();
+    }
+
     /* N Drawing w/ SmartMatrix */
     uint32_t curMillis = millis();
 
@@ -499,6 +976,7 @@ void loop() {
 
         /* Draw frame. */
         backgroundLayer.fillScreen(defaultBackgroundColor);
+        N::DRAW::DrawArgs::Glitches glitches = {}; // For the whole frame, once every layer is drawn.
 
         if (!N::displayOn) {
             goto end_of_frame;
@@ -513,6 +991,7 @@ void loop() {
                 args_alt.glitches.fail = { .enabled = true, .chance = 0.02f };
                 args_alt.glitches.chromatic = { .enabled = true, .chance = 0.02f, .magnitude = 80 };
                 N::DRAW::drawFromRAM(args_alt, (uint8_t *)knockedtfout_png, (int)knockedtfout_png_len);
+                glitches = args_alt.glitches;
                 break;
             }
 
@@ -523,12 +1002,8 @@ void loop() {
             }
 
             case (N::modes::NCFG_M_TEST_ANIM): { // animation on sd card with transparency and layers example
-                N::DRAW::DrawArgs args_alt = DrawArgs_DEFAULT;
-                args_alt.drawBlack = false;
-                args_alt.mixBlack = false;
-
                 N::ANIM::testSpeed.drawNextFrame(DrawArgs_DEFAULT);
-                N::ANIM::testSuite.drawNextFrame(args_alt);
+                N::ANIM::testSuite.drawNextFrame(DrawArgs_DEFAULT); // The default `BLEND_OVER` already composites with real alpha, so `testSpeed` shows through.
                 break;
             }
     
@@ -538,6 +1013,10 @@ void loop() {
                 break;
             }
         }
+
+        /* Blend the layers, then post-process the composed frame. */
+        N::DRAW::compose();
+        N::DRAW::postProcess(glitches);
     } 
 
     end_of_frame:
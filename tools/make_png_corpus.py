@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+"""
+Builds the 64x64 PNG benchmark corpus as a C header (same layout as `xxd -i`).
+
+Every pixel type / bit depth PNGdec supports is encoded once per filter type,
+with every row using that one filter, so the benchmark can time each
+DeFilter() case and each PNGRGB565() case in isolation.
+`rgba8_split` is rgba8/paeth again, flushed into several deflate blocks and
+split over several IDAT chunks, the way some encoders write bigger images.
+Each image also records the length and CRC-32 of what Python's zlib inflates
+its IDAT data to, for checking PNGdec's inflate against.
+`corpusTooWide` holds 64-row images wider than 64 pixels at low bit depths, whose
+lines still fit a 64x4-byte line buffer, for checking they fail with PNG_TOO_BIG.
+The rgb8 and rgba8 scenes are also QOI-encoded (tools/png_to_qoi.py), each
+paired with the PNG of the same pixels, for checking src/include/qoi.hpp.
+
+Usage: python3 tools/make_png_corpus.py [src/bench/png_corpus.h]
+(`pio run -e native` runs this automatically via tools/pio_png_corpus.py.)
+"""
+
+import os
+import random
+import struct
+import sys
+import zlib
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from png_to_qoi import encode as qoi_encode  # noqa: E402
+
+SIZE = 64
+FILTERS = ["none", "sub", "up", "avg", "paeth"]
+
+# (name, color type, bit depth, has tRNS)
+PIXEL_TYPES = [
+    ("gray1",     0, 1, False),
+    ("gray2",     0, 2, False),
+    ("gray4",     0, 4, False),
+    ("gray8",     0, 8, False),
+    ("rgb8",      2, 8, False),
+    ("indexed1",  3, 1, False),
+    ("indexed2",  3, 2, False),
+    ("indexed4",  3, 4, False),
+    ("indexed8",  3, 8, False),
+    ("indexed8a", 3, 8, True),
+    ("graya8",    4, 8, False),
+    ("rgba8",     6, 8, False),
+]
+
+
+def sample(x, y, rng):
+    """A smooth-ish test scene (gradients, a disc, a little noise) as 0-255 RGBA."""
+    r = (x * 4) & 0xFF
+    g = (y * 4) & 0xFF
+    b = ((x + y) * 2) & 0xFF
+    a = 255
+    dx, dy = x - 40, y - 24
+    if dx * dx + dy * dy < 14 * 14:  # a disc so there are hard edges
+        r, g, b = 255 - r, 200, 40
+    if y >= 56:  # a noisy band so the inflate and filters have real work to do
+        r = (r + rng.randrange(8)) & 0xFF
+        g = (g + rng.randrange(8)) & 0xFF
+        b = (b + rng.randrange(8)) & 0xFF
+    if x < 8 or x >= 56:  # soft transparent edges, like the asprite bloom halos
+        a = min(x, 63 - x) * 32
+    return r, g, b, a
+
+
+def raw_rows(ctype, depth, rng, width=SIZE):
+    levels = (1 << depth) - 1
+    rows = []
+    for y in range(SIZE):
+        px = [sample(x, y, rng) for x in range(width)]
+        if ctype == 0:
+            vals = [((r + g + b) // 3) * levels // 255 for r, g, b, a in px]
+        elif ctype == 3:
+            vals = [(x // 4 + y // 4 + (r >> 5)) & levels for x, (r, g, b, a) in enumerate(px)]
+        if ctype in (0, 3):
+            bits = 0
+            nbits = 0
+            row = bytearray()
+            for v in vals:
+                bits = (bits << depth) | v
+                nbits += depth
+                if nbits == 8:
+                    row.append(bits)
+                    bits = nbits = 0
+            rows.append(bytes(row))
+        elif ctype == 2:
+            rows.append(bytes(c for r, g, b, a in px for c in (r, g, b)))
+        elif ctype == 4:
+            rows.append(bytes(c for r, g, b, a in px for c in ((r + g + b) // 3, a)))
+        elif ctype == 6:
+            rows.append(bytes(c for p in px for c in p))
+    return rows
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+
+def filter_rows(rows, ftype, bpp):
+    out = bytearray()
+    prev = bytes(len(rows[0]))
+    for row in rows:
+        out.append(ftype)
+        for i, v in enumerate(row):
+            a = row[i - bpp] if i >= bpp else 0
+            b = prev[i]
+            c = prev[i - bpp] if i >= bpp else 0
+            pred = [0, a, b, (a + b) // 2, paeth(a, b, c)][ftype]
+            out.append((v - pred) & 0xFF)
+        prev = row
+    return bytes(out)
+
+
+def chunk(tag, data):
+    return struct.pack(">I", len(data)) + tag + data + struct.pack(">I", zlib.crc32(tag + data))
+
+
+def split_idat(data, rows_per_block, chunk_size):
+    """Compresses with a sync flush every few rows (a new block each time) and cuts it into IDAT chunks.
+    Huffman-only, so zlib writes dynamic blocks rather than fixed ones for this data."""
+    row_len = len(data) // SIZE
+    z = zlib.compressobj(9, zlib.DEFLATED, 15, 9, zlib.Z_HUFFMAN_ONLY)
+    out = b""
+    for y in range(0, SIZE, rows_per_block):
+        out += z.compress(data[y * row_len:(y + rows_per_block) * row_len]) + z.flush(zlib.Z_SYNC_FLUSH)
+    out += z.flush()
+    return b"".join(chunk(b"IDAT", out[i:i + chunk_size]) for i in range(0, len(out), chunk_size))
+
+
+def inflated(png):
+    """Length and CRC-32 of the image's IDAT data, inflated by zlib."""
+    data = b""
+    i = 8
+    while i < len(png):
+        length, tag = struct.unpack(">I4s", png[i:i + 8])
+        if tag == b"IDAT":
+            data += png[i + 8:i + 8 + length]
+        i += length + 12
+    raw = zlib.decompress(data)
+    return len(raw), zlib.crc32(raw)
+
+
+def make_png(ctype, depth, trns, ftype, seed, split=False, width=SIZE):
+    rng = random.Random(seed)
+    rows = raw_rows(ctype, depth, rng, width)
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[ctype]
+    bpp = max(1, channels * depth // 8)
+    png = b"\x89PNG\r\n\x1a\n"
+    png += chunk(b"IHDR", struct.pack(">IIBBBBB", width, SIZE, depth, ctype, 0, 0, 0))
+    if ctype == 3:
+        colors = 1 << depth
+        pal = bytearray()
+        for i in range(colors):
+            pal += bytes(((i * 97) & 0xFF, (i * 53 + 40) & 0xFF, (255 - i * 29) & 0xFF))
+        png += chunk(b"PLTE", bytes(pal))
+        if trns:
+            png += chunk(b"tRNS", bytes((i * 37) & 0xFF for i in range(colors)))
+    if split:
+        png += split_idat(filter_rows(rows, ftype, bpp), 16, 1000)
+    else:
+        png += chunk(b"IDAT", zlib.compress(filter_rows(rows, ftype, bpp), 9))
+    png += chunk(b"IEND", b"")
+    return png
+
+
+def make_qoi(ctype, seed):
+    """The same pixels as make_png(ctype, 8, ...) with the same seed, as a QOI."""
+    rows = raw_rows(ctype, 8, random.Random(seed))
+    channels = {2: 3, 6: 4}[ctype]
+    data = b"".join(rows)
+    pixels = [tuple(data[i:i + channels]) + ((255,) if channels == 3 else ())
+              for i in range(0, len(data), channels)]
+    return qoi_encode(pixels, SIZE, SIZE, channels)
+
+
+def c_array(lines, var, data):
+    lines.append("unsigned char %s[] = {" % var)
+    for i in range(0, len(data), 12):
+        lines.append("  " + ", ".join("0x%02x" % c for c in data[i:i + 12]) + ",")
+    lines[-1] = lines[-1].rstrip(",")
+    lines.append("};")
+    lines.append("unsigned int %s_len = %d;" % (var, len(data)))
+
+
+def main():
+    out_path = sys.argv[1] if len(sys.argv) > 1 else "src/bench/png_corpus.h"
+    lines = [
+        "// Generated by tools/make_png_corpus.py -- do not edit by hand.",
+        "// 64x64 PNGs: every supported pixel type, each encoded with every filter.",
+        "",
+    ]
+    names = []
+    images = [("%s_%s" % (name, fname), make_png(ctype, depth, trns, ftype, seed))
+              for seed, (name, ctype, depth, trns) in enumerate(PIXEL_TYPES)
+              for ftype, fname in enumerate(FILTERS)]
+    images.append(("rgba8_split", make_png(6, 8, False, 4, len(PIXEL_TYPES) - 1, split=True)))
+    for name, data in images:
+        var = "corpus_%s_png" % name
+        c_array(lines, var, data)
+        names.append((var, name) + inflated(data))
+    lines.append("")
+    lines.append("struct CorpusImage { const char *name; uint8_t *data; unsigned int *len; unsigned int inflatedLen; uint32_t inflatedCRC; };")
+    lines.append("CorpusImage corpusImages[] = {")
+    for var, name, raw_len, raw_crc in names:
+        lines.append('    { "%s", %s, &%s_len, %d, 0x%08x },' % (name, var, var, raw_len, raw_crc))
+    lines.append("};")
+
+    wide = [("indexed8_200", make_png(3, 8, False, 0, 0, width=200)),  # 200-byte lines
+            ("gray1_2048", make_png(0, 1, False, 0, 0, width=2048))]   # 256-byte lines
+    for name, data in wide:
+        c_array(lines, "corpus_%s_png" % name, data)
+    lines.append("")
+    lines.append("struct CorpusWide { const char *name; uint8_t *data; unsigned int *len; int width; };")
+    lines.append("CorpusWide corpusTooWide[] = {")
+    for name, data in wide:
+        var = "corpus_%s_png" % name
+        lines.append('    { "%s", %s, &%s_len, %d },' % (name, var, var, struct.unpack(">I", data[16:20])[0]))
+    lines.append("};")
+
+    qois = []
+    for seed, (name, ctype, depth, trns) in enumerate(PIXEL_TYPES):
+        if name in ("rgb8", "rgba8"):
+            var = "corpus_%s_qoi" % name
+            c_array(lines, var, make_qoi(ctype, seed))
+            qois.append((var, name, [n for _, n, _, _ in names].index(name + "_none")))
+    lines.append("")
+    lines.append("struct CorpusQOI { const char *name; uint8_t *data; unsigned int *len; int png; }; // `png` indexes the `corpusImages` entry with the same pixels.")
+    lines.append("CorpusQOI corpusQOIs[] = {")
+    for var, name, png in qois:
+        lines.append('    { "%s", %s, &%s_len, %d },' % (name, var, var, png))
+    lines.append("};")
+    with open(out_path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
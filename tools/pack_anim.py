@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+"""
+Packs an animation's frame files into one `.anim` file for the SD card.
+
+Reads `<root>/<name>/<name>1.png`, `<name>2.png`, ... (stopping at the first
+missing number, same as playback) and writes `<root>/<name>.anim`. With
+`--qoi`, reads the `<name>N.qoi` frames `tools/png_to_qoi.py` made instead. The device
+prefers the pack over the frame folder, keeps it open, and seeks to each frame
+by its table entry instead of opening a file per frame.
+
+Layout (little-endian, matches `N::ANIM::PackHeader`/`PackFrame` in main.cpp):
+    header: char magic[4] = "NANM", u16 version = 1, u16 frameCount,
+            u16 width, u16 height
+    table:  frameCount x { u32 offset, u32 size, u16 durationMillis,
+                           u8 format (0 = PNG or QOI file, 1 = raw rgb24),
+                           u8 reserved }
+    data:   the frames, back to back
+
+Raw frames skip PNG decoding entirely at the cost of 12 KiB each, and need
+Pillow (`pip install pillow`) to decode the source PNGs.
+
+Usage: python3 tools/pack_anim.py <root> <name> [--duration MS] [--raw | --qoi]
+(`<root>` is the SD card's `animations/` folder.)
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b"NANM"
+VERSION = 1
+SIZE = 64
+FORMAT_FILE = 0  # the device tells PNG from QOI by magic
+FORMAT_RGB24 = 1
+HEADER = struct.Struct("<4sHHHH")
+FRAME = struct.Struct("<IIHBB")
+
+
+def png_size(data):
+    if data[:8] != b"\x89PNG\r\n\x1a\n" or data[12:16] != b"IHDR":
+        raise ValueError("not a PNG")
+    return struct.unpack(">II", data[16:24])
+
+
+def qoi_size(data):
+    if data[:4] != b"qoif":
+        raise ValueError("not a QOI")
+    return struct.unpack(">II", data[4:12])
+
+
+def to_rgb24(path):
+    from PIL import Image  # only needed for --raw
+    with Image.open(path) as img:
+        return img.convert("RGB").tobytes()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack animations/<name>/<name>N.png into animations/<name>.anim.")
+    parser.add_argument("root", help="the animations/ folder")
+    parser.add_argument("name")
+    parser.add_argument("--duration", type=int, default=0, help="ms per frame; 0 advances every drawn frame (default)")
+    kind = parser.add_mutually_exclusive_group()
+    kind.add_argument("--raw", action="store_true", help="store frames as raw rgb24 instead of PNG")
+    kind.add_argument("--qoi", action="store_true", help="store the <name>N.qoi frames instead of the PNGs")
+    args = parser.parse_args()
+
+    frames = []
+    while True:
+        path = os.path.join(args.root, args.name, "%s%d.%s" % (args.name, len(frames) + 1, "qoi" if args.qoi else "png"))
+        if not os.path.exists(path):
+            break
+        with open(path, "rb") as f:
+            data = f.read()
+        if (qoi_size(data) if args.qoi else png_size(data)) != (SIZE, SIZE):
+            sys.exit("%s: frames must be %dx%d" % (path, SIZE, SIZE))
+        frames.append(to_rgb24(path) if args.raw else data)
+
+    if not frames:
+        sys.exit("no frames found at %s" % os.path.join(args.root, args.name, "%s1.%s" % (args.name, "qoi" if args.qoi else "png")))
+    if len(frames) > 512:
+        sys.exit("%d frames; the device's table holds 512" % len(frames))
+
+    offset = HEADER.size + FRAME.size * len(frames)
+    table = b""
+    for data in frames:
+        table += FRAME.pack(offset, len(data), args.duration, FORMAT_RGB24 if args.raw else FORMAT_FILE, 0)
+        offset += len(data)
+
+    out_path = os.path.join(args.root, args.name + ".anim")
+    with open(out_path, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, len(frames), SIZE, SIZE))
+        f.write(table)
+        for data in frames:
+            f.write(data)
+    print("%s: %d frames, %d bytes" % (out_path, len(frames), offset))
+
+
+if __name__ == "__main__":
+    main()
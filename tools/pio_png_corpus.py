@@ -0,0 +1,16 @@
+# PlatformIO `pre:` script for `env:native`: (re)generates the benchmark corpus
+# header before the build so the generated file never has to be committed, and
+# quiets the warnings zlib's own C files give under `-Wextra`.
+Import("env")
+
+import os
+import subprocess
+
+project_dir = env.subst("$PROJECT_DIR")
+subprocess.check_call([
+    env.subst("$PYTHONEXE"),
+    os.path.join(project_dir, "tools", "make_png_corpus.py"),
+    os.path.join(project_dir, "src", "bench", "png_corpus.h"),
+])
+
+env.Append(CFLAGS=["-Wno-implicit-fallthrough", "-Wno-unused-parameter"]) # Only zlib is C.
@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+Converts PNG frames to QOI ("Quite OK Image", https://qoiformat.org) for the
+SD card.
+
+Every `<folder>/*.png` given (or every PNG named directly) gets a `.qoi` next
+to it with the same name. `N::ANIM::Animation` picks the decoder by magic, and
+a frame folder with both `<name>N.png` and `<name>N.qoi` plays the `.qoi`,
+which decodes several times faster than the PNG at some cost in size. To pack
+them, run `tools/pack_anim.py <root> <name> --qoi` afterwards.
+
+PNGs with an alpha channel or tRNS become 4-channel QOIs, the rest 3-channel.
+Decoding the PNGs needs Pillow (`pip install pillow`); `encode()` itself
+doesn't, and `tools/make_png_corpus.py` uses it for the benchmark corpus.
+
+Usage: python3 tools/png_to_qoi.py <folder or .png> [...]
+(e.g. `python3 tools/png_to_qoi.py animations/*/` on the SD card.)
+"""
+
+import os
+import struct
+import sys
+
+MAGIC = b"qoif"
+PADDING = b"\x00" * 7 + b"\x01"
+OP_INDEX = 0x00
+OP_DIFF = 0x40
+OP_LUMA = 0x80
+OP_RUN = 0xC0
+OP_RGB = 0xFE
+OP_RGBA = 0xFF
+
+
+def encode(pixels, width, height, channels):
+    """QOI-encodes `pixels`, a list of (r, g, b, a) tuples in row-major order.
+    Same choices as the reference encoder, so output matches `qoi.h`."""
+    out = bytearray(MAGIC + struct.pack(">IIBB", width, height, channels, 0))
+    index = [(0, 0, 0, 0)] * 64
+    prev = (0, 0, 0, 255)
+    run = 0
+    for i, px in enumerate(pixels):
+        if px == prev:
+            run += 1
+            if run == 62 or i == len(pixels) - 1:
+                out.append(OP_RUN | (run - 1))
+                run = 0
+            continue
+        if run:
+            out.append(OP_RUN | (run - 1))
+            run = 0
+
+        r, g, b, a = px
+        h = (r * 3 + g * 5 + b * 7 + a * 11) % 64
+        if index[h] == px:
+            out.append(OP_INDEX | h)
+        else:
+            index[h] = px
+            if a == prev[3]:
+                vr = (r - prev[0] + 128) % 256 - 128  # wrapped to -128..127
+                vg = (g - prev[1] + 128) % 256 - 128
+                vb = (b - prev[2] + 128) % 256 - 128
+                vg_r, vg_b = vr - vg, vb - vg
+                if -3 < vr < 2 and -3 < vg < 2 and -3 < vb < 2:
+                    out.append(OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2))
+                elif -33 < vg < 32 and -9 < vg_r < 8 and -9 < vg_b < 8:
+                    out += bytes((OP_LUMA | (vg + 32), (vg_r + 8) << 4 | (vg_b + 8)))
+                else:
+                    out += bytes((OP_RGB, r, g, b))
+            else:
+                out += bytes((OP_RGBA, r, g, b, a))
+        prev = px
+    out += PADDING
+    return bytes(out)
+
+
+def convert(path):
+    from PIL import Image  # only needed for converting files
+    with Image.open(path) as img:
+        channels = 4 if img.mode in ("RGBA", "LA", "PA") or "transparency" in img.info else 3
+        rgba = img.convert("RGBA")
+        data = encode(list(rgba.getdata()), rgba.width, rgba.height, channels)
+    out_path = os.path.splitext(path)[0] + ".qoi"
+    with open(out_path, "wb") as f:
+        f.write(data)
+    print("%s: %d -> %d bytes" % (out_path, os.path.getsize(path), len(data)))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__.strip().splitlines()[-2])
+    for arg in sys.argv[1:]:
+        if os.path.isdir(arg):
+            for name in sorted(os.listdir(arg)):
+                if name.lower().endswith(".png"):
+                    convert(os.path.join(arg, name))
+        else:
+            convert(arg)
+
+
+if __name__ == "__main__":
+    main()